@@ -46,8 +46,11 @@
 #include <getopt.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <limits.h>
+#include <unistd.h>
 
 #include <rte_common.h>
+#include <rte_version.h>
 #include <rte_log.h>
 #include <rte_malloc.h>
 #include <rte_memory.h>
@@ -71,6 +74,9 @@
 #include <rte_ring.h>
 #include <rte_mempool.h>
 #include <rte_mbuf.h>
+#if RTE_VERSION >= RTE_VERSION_NUM(17,5,0,0)
+#include <rte_pause.h>
+#endif
 
 static volatile bool force_quit;
 
@@ -201,6 +207,195 @@ print_load_statistics (int portid)
     printf("\n");
 }
 
+/*
+ * Adaptive polling (--power). An lcore that has received nothing for
+ * a while backs off in steps: after POWER_SPIN_US it pauses between
+ * polls, after POWER_SLEEP_AFTER_US it sleeps POWER_SLEEP_US between
+ * polls, and after power_intr_ms it waits for an RX interrupt (at
+ * most POWER_INTR_TIMEOUT_MS, so that the timers keep running). TX
+ * buffers are drained every BURST_TX_DRAIN_US, well before sleeping.
+ */
+#define POWER_SPIN_US           100
+#define POWER_SLEEP_AFTER_US    1000
+#define POWER_SLEEP_US          50
+#define POWER_PAUSES            64
+#define POWER_INTR_TIMEOUT_MS   10
+#define POWER_INTR_DEFAULT_MS   100
+
+#define POWER_STEP_NONE  0
+#define POWER_STEP_PAUSE 1
+#define POWER_STEP_SLEEP 2
+#define POWER_STEP_INTR  3
+
+static int power_mode = 0;
+static unsigned power_intr_ms = POWER_INTR_DEFAULT_MS;
+static uint64_t power_spin_tsc, power_sleep_tsc, power_intr_tsc;
+
+/* ports configured with RX interrupts */
+static int port_rx_intr[RTE_MAX_ETHPORTS];
+
+struct lcore_power {
+        uint64_t idle_since;    /* TSC of the last busy iteration */
+        int step;               /* back-off step of the last iteration */
+        uint64_t step_cycles;   /* ... and how long it took */
+        int intr_woken;         /* POWER_STEP_INTR ended by an interrupt */
+        int intr_ok;            /* RX queues added to the epoll set */
+        uint64_t sleep_cycles;
+        uint64_t intr_cycles;
+        uint64_t wakes;         /* back-off steps followed by traffic */
+        uint64_t intr_wakes;    /* ... woken by an interrupt */
+        uint64_t lat_cycles;    /* sum and max of the other steps' durations */
+        uint64_t lat_max;
+        uint64_t prev[5];
+} __rte_cache_aligned;
+static struct lcore_power lcore_power[RTE_MAX_LCORE];
+static uint64_t power_print_tsc;
+
+static void
+power_init(void)
+{
+        uint64_t us = (rte_get_tsc_hz() + US_PER_S - 1) / US_PER_S;
+
+        power_spin_tsc = us * POWER_SPIN_US;
+        power_sleep_tsc = us * POWER_SLEEP_AFTER_US;
+        power_intr_tsc = us * 1000 * power_intr_ms;
+        if (power_intr_tsc > 0 && power_intr_tsc < power_sleep_tsc)
+                power_intr_tsc = power_sleep_tsc;
+        power_print_tsc = rte_rdtsc();
+}
+
+/* add the RX queues of the lcore to its epoll set */
+static void
+power_intr_setup(unsigned lcore_id, struct lcore_queue_conf *qconf)
+{
+        struct lcore_power *ps = &lcore_power[lcore_id];
+        unsigned i, portid;
+
+        if (!power_mode || power_intr_tsc == 0)
+                return;
+        for (i = 0; i < qconf->n_rx_port; i++) {
+                portid = qconf->rx_port_list[i];
+                if (!port_rx_intr[portid] ||
+                    rte_eth_dev_rx_intr_ctl_q(portid, 0, RTE_EPOLL_PER_THREAD,
+                                              RTE_INTR_EVENT_ADD, NULL) < 0) {
+                        RTE_LOG(WARNING, L2FWD, "lcore %u: no RX interrupt "
+                                "for port %u, sleeping in short steps instead\n",
+                                lcore_id, portid);
+                        return;
+                }
+        }
+        ps->intr_ok = 1;
+}
+
+/* wait for an RX interrupt on any of the lcore's ports, returns 1 if woken */
+static int
+power_intr_wait(struct lcore_queue_conf *qconf)
+{
+        struct rte_epoll_event event[MAX_RX_QUEUE_PER_LCORE];
+        unsigned i;
+        int n;
+
+        for (i = 0; i < qconf->n_rx_port; i++)
+                rte_eth_dev_rx_intr_enable(qconf->rx_port_list[i], 0);
+        n = rte_epoll_wait(RTE_EPOLL_PER_THREAD, event, MAX_RX_QUEUE_PER_LCORE,
+                           POWER_INTR_TIMEOUT_MS);
+        for (i = 0; i < qconf->n_rx_port; i++)
+                rte_eth_dev_rx_intr_disable(qconf->rx_port_list[i], 0);
+        return n > 0;
+}
+
+/* end of a main loop iteration that received nb_rx packets */
+static void
+power_poll(unsigned lcore_id, struct lcore_queue_conf *qconf, unsigned nb_rx,
+           uint64_t cur_tsc)
+{
+        struct lcore_power *ps = &lcore_power[lcore_id];
+        uint64_t idle, start;
+        int i;
+
+        if (nb_rx > 0 || unlikely(ps->idle_since == 0)) {
+                if (ps->step != POWER_STEP_NONE) {
+                        ps->wakes++;
+                        if (ps->step == POWER_STEP_INTR && ps->intr_woken) {
+                                ps->intr_wakes++;
+                        } else {
+                                ps->lat_cycles += ps->step_cycles;
+                                if (ps->step_cycles > ps->lat_max)
+                                        ps->lat_max = ps->step_cycles;
+                        }
+                        ps->step = POWER_STEP_NONE;
+                }
+                ps->idle_since = cur_tsc;
+                return;
+        }
+
+        idle = cur_tsc - ps->idle_since;
+        if (idle < power_spin_tsc)
+                return;
+
+        start = rte_rdtsc();
+        if (idle < power_sleep_tsc) {
+                for (i = 0; i < POWER_PAUSES; i++)
+                        rte_pause();
+                ps->step = POWER_STEP_PAUSE;
+        } else if (!ps->intr_ok || idle < power_intr_tsc) {
+                usleep(POWER_SLEEP_US);
+                ps->step = POWER_STEP_SLEEP;
+                ps->sleep_cycles += rte_rdtsc() - start;
+        } else {
+                ps->intr_woken = power_intr_wait(qconf);
+                ps->step = POWER_STEP_INTR;
+                ps->intr_cycles += rte_rdtsc() - start;
+        }
+        ps->step_cycles = rte_rdtsc() - start;
+}
+
+/*
+ * Per lcore with RX ports: share of the time spent sleeping and waiting
+ * for interrupts, and the wakeups that found traffic. The wake latency is
+ * the length of the step before such a wakeup, the most it delayed
+ * the first packet; that of interrupt wakeups is not measured.
+ */
+static void
+print_power_stats(void)
+{
+        uint64_t now = rte_rdtsc();
+        double elapsed = (double) (now - power_print_tsc);
+        double us = (double) rte_get_tsc_hz() / US_PER_S;
+        unsigned lcore_id;
+        int i;
+
+        printf("\nPower:");
+        RTE_LCORE_FOREACH(lcore_id) {
+                struct lcore_power *ps = &lcore_power[lcore_id];
+                uint64_t cur[5], d[5], lat_wakes;
+
+                if (lcore_queue_conf[lcore_id].n_rx_port == 0)
+                        continue;
+                cur[0] = ps->sleep_cycles;
+                cur[1] = ps->intr_cycles;
+                cur[2] = ps->wakes;
+                cur[3] = ps->intr_wakes;
+                cur[4] = ps->lat_cycles;
+                for (i = 0; i < 5; i++) {
+                        d[i] = cur[i] - ps->prev[i];
+                        ps->prev[i] = cur[i];
+                }
+                lat_wakes = d[2] - d[3];
+                printf("\n  lcore %2u: idle %5.1f%% (sleep %5.1f%%, intr %5.1f%%)"
+                       "  wakeups %"PRIu64" (intr %"PRIu64")"
+                       "  wake latency avg %.1f max %.1f us",
+                       lcore_id,
+                       100.0 * (double) (d[0] + d[1]) / elapsed,
+                       100.0 * (double) d[0] / elapsed,
+                       100.0 * (double) d[1] / elapsed,
+                       d[2], d[3],
+                       lat_wakes > 0 ? (double) d[4] / (double) lat_wakes / us : 0.0,
+                       (double) ps->lat_max / us);
+        }
+        power_print_tsc = now;
+}
+
 /* Print out statistics on packets dropped */
 static void
 print_stats(void)
@@ -238,6 +433,8 @@ print_stats(void)
                    total_packets_tx,
                    total_packets_rx,
                    total_packets_dropped);
+        if (power_mode)
+                print_power_stats();
         printf("\n====================================================\n");
         fflush(stdout);
 }
@@ -270,7 +467,7 @@ bounce_main_loop(void)
         int sent;
         unsigned lcore_id;
         uint64_t prev_tsc, diff_tsc, cur_tsc, timer_tsc;
-        unsigned i, j, portid, nb_rx;
+        unsigned i, j, portid, nb_rx, nb_rx_total;
         struct lcore_queue_conf *qconf;
         const uint64_t drain_tsc = (rte_get_tsc_hz() + US_PER_S - 1) / US_PER_S *
                         BURST_TX_DRAIN_US;
@@ -299,6 +496,8 @@ bounce_main_loop(void)
 
         }
 
+        power_intr_setup(lcore_id, qconf);
+
         while (!force_quit) {
 
                 cur_tsc = rte_rdtsc();
@@ -344,6 +543,7 @@ bounce_main_loop(void)
                 /*
                  * Read packet from RX queues
                  */
+                nb_rx_total = 0;
                 for (i = 0; i < qconf->n_rx_port; i++) {
 
                         portid = qconf->rx_port_list[i];
@@ -351,6 +551,7 @@ bounce_main_loop(void)
                                                  pkts_burst, MAX_PKT_BURST);
 
                         port_statistics[portid].rx += nb_rx;
+                        nb_rx_total += nb_rx;
 
                         update_load_statistics(portid, nb_rx);
 
@@ -366,6 +567,9 @@ bounce_main_loop(void)
                                 }
                         }
                 }
+
+                if (power_mode)
+                        power_poll(lcore_id, qconf, nb_rx_total, cur_tsc);
         }
 }
 
@@ -383,8 +587,10 @@ bounce_usage(const char *prgname)
         printf("%s [EAL options] -- -p PORTMASK [-q NQ]\n"
                "  -p PORTMASK: hexadecimal bitmask of ports to configure\n"
                "  -q NQ: number of queue (=ports) per lcore (default is 1)\n"
-                   "  -T PERIOD: statistics will be refreshed each PERIOD seconds (0 to disable, 10 default, 86400 maximum)\n",
-               prgname);
+                   "  -T PERIOD: statistics will be refreshed each PERIOD seconds (0 to disable, 10 default, 86400 maximum)\n"
+               "  --power: back off and sleep when idle, then wait for RX interrupts\n"
+               "  --power-intr-ms MS: idle time before waiting for interrupts (0 to disable, %u default)\n",
+               prgname, POWER_INTR_DEFAULT_MS);
 }
 
 static int
@@ -438,6 +644,25 @@ bounce_parse_timer_period(const char *q_arg)
         return n;
 }
 
+static unsigned int
+bounce_parse_power_intr_ms(const char *q_arg)
+{
+        char *end = NULL;
+        unsigned long n;
+
+        /* parse number string */
+        n = strtoul(q_arg, &end, 10);
+        if ((q_arg[0] == '\0') || (end == NULL) || (*end != '\0'))
+                return UINT_MAX;
+        if (n > MAX_TIMER_PERIOD * 1000)
+                return UINT_MAX;
+
+        return n;
+}
+
+#define CMD_LINE_OPT_POWER 256
+#define CMD_LINE_OPT_POWER_INTR_MS 257
+
 /* Parse the argument given in the command line of the application */
 static int
 bounce_parse_args(int argc, char **argv)
@@ -448,6 +673,8 @@ bounce_parse_args(int argc, char **argv)
         char *prgname = argv[0];
         static struct option lgopts[] = {
                 {"use-local-hw-addr", no_argument, NULL, 'l'},
+                {"power", no_argument, NULL, CMD_LINE_OPT_POWER},
+                {"power-intr-ms", required_argument, NULL, CMD_LINE_OPT_POWER_INTR_MS},
                 {NULL, 0, 0, 0}
         };
 
@@ -497,6 +724,20 @@ bounce_parse_args(int argc, char **argv)
                         use_local_hw_address = 1;
                         break;
 
+                /* adaptive polling */
+                case CMD_LINE_OPT_POWER:
+                        power_mode = 1;
+                        break;
+
+                case CMD_LINE_OPT_POWER_INTR_MS:
+                        power_intr_ms = bounce_parse_power_intr_ms(optarg);
+                        if (power_intr_ms == UINT_MAX) {
+                                printf("invalid interrupt idle time\n");
+                                bounce_usage(prgname);
+                                return -1;
+                        }
+                        break;
+
                 /* long options */
                 case 0:
                         bounce_usage(prgname);
@@ -590,6 +831,7 @@ main(int argc, char **argv)
 {
         struct lcore_queue_conf *qconf;
         struct rte_eth_dev_info dev_info;
+        struct rte_eth_conf local_port_conf;
         int ret;
         uint8_t nb_ports;
         uint8_t nb_ports_available;
@@ -612,6 +854,7 @@ main(int argc, char **argv)
         ret = bounce_parse_args(argc, argv);
         if (ret < 0)
                 rte_exit(EXIT_FAILURE, "Invalid L2FWD arguments\n");
+        power_init();
 
         /* create the mbuf pool */
         bounce_pktmbuf_pool = rte_pktmbuf_pool_create("mbuf_pool", NB_MBUF, 32,
@@ -684,10 +927,19 @@ main(int argc, char **argv)
                 /* init port */
                 printf("Initializing port %u... ", (unsigned) portid);
                 fflush(stdout);
-                ret = rte_eth_dev_configure(portid, 1, 1, &port_conf);
+                local_port_conf = port_conf;
+                if (power_mode && power_intr_ms > 0)
+                        local_port_conf.intr_conf.rxq = 1;
+                ret = rte_eth_dev_configure(portid, 1, 1, &local_port_conf);
+                if (ret < 0 && local_port_conf.intr_conf.rxq) {
+                        printf("no RX interrupts, ");
+                        local_port_conf.intr_conf.rxq = 0;
+                        ret = rte_eth_dev_configure(portid, 1, 1, &local_port_conf);
+                }
                 if (ret < 0)
                         rte_exit(EXIT_FAILURE, "Cannot configure device: err=%d, port=%u\n",
                                   ret, (unsigned) portid);
+                port_rx_intr[portid] = local_port_conf.intr_conf.rxq;
 
                 rte_eth_macaddr_get(portid,&bounce_ports_eth_addr[portid]);
 
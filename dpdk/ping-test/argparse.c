@@ -147,6 +147,9 @@ usage (const char *prgname)
 "  --log-packets            - log packets in log file\n"
 "  --log-pkt-len <int>      - Maximum packet size to capture in log\n"
 "  --log-file <fname>       - Log File Name\n"
+"  --log-binary             - binary log records (route/decode-log.py)\n"
+"  --log-max-size <MB>      - start a new log file at this size\n"
+"  --log-segments <n>       - log files kept with --log-max-size (default %u)\n"
 "  --port <index>           - Port Index\n"
 "  --l-ip-addr <IPv4 addr>  - Local IP address\n"
 "  --r-ip-addr <IPv4 addr>  - Local IP address\n"
@@ -156,7 +159,7 @@ usage (const char *prgname)
 "  --count <ping count>     - maximum number of PINGs\n"
 "  --duration <seconds>     - maximum duration of test\n"
 "  --rate <pps>             - Ping rate\n"
-    "\n");
+    "\n", DBGMSG_DEFAULT_SEGMENTS);
 }
 
 /* Parse the argument given in the command line of the application */
@@ -180,6 +183,9 @@ parse_args (int argc, char **argv)
         { "dump-file", required_argument, NULL, 1004},
         { "log-file", required_argument, NULL, 1005},
         { "log-level", required_argument, NULL, 1006},
+        { "log-binary", no_argument, &dbgmsg_globals.log_binary, 1},
+        { "log-max-size", required_argument, NULL, 1007},
+        { "log-segments", required_argument, NULL, 1008},
         { "rate", required_argument, NULL, 'r'},
         { NULL, 0, 0, 0}
     };
@@ -237,14 +243,22 @@ parse_args (int argc, char **argv)
             if (rc) goto ParseError;
             break;
 
-        case 1005: /* --log-file */
-            rc = dbgmsg_fopen(optarg);
-            if (rc) goto ParseError;
+        case 1005: /* --log-file, opened after the other log options */
+            dbgmsg_globals.log_fname = optarg;
             break;
         case 1006: /* --log-level */
             rc = parse_integer(optarg, &dbgmsg_globals.log_level, 0, 5);
             if (rc) goto ParseError;
             break;
+        case 1007: /* --log-max-size */
+            rc = parse_integer(optarg, &int_value, 0, MAXINT);
+            if (rc) goto ParseError;
+            dbgmsg_globals.log_max_size = (uint64_t) int_value << 20;
+            break;
+        case 1008: /* --log-segments */
+            rc = parse_integer(optarg, &dbgmsg_globals.log_segments, 1, 1000);
+            if (rc) goto ParseError;
+            break;
 
         /* long options */
         case 0:
@@ -267,6 +281,10 @@ parse_args (int argc, char **argv)
         }
     }
 
+    if ((dbgmsg_globals.log_fname != NULL)
+            && (dbgmsg_fopen(dbgmsg_globals.log_fname) < 0))
+        return -1;
+
     if (optind >= 0)
         argv[optind-1] = prgname;
 
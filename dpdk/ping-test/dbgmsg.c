@@ -1,8 +1,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
+#include <limits.h>
 
 #include <rte_cycles.h>
+#include <rte_spinlock.h>
 
 #include "defines.h"
 #include "dbgmsg.h"
@@ -15,6 +18,10 @@ dbgmsg_globals_t dbgmsg_globals;
 
 static float dbg_speed_factor = 0;
 
+/* Serializes writing and rotating the log file */
+static rte_spinlock_t log_lock;
+static uint64_t log_fsize = 0;          /* Bytes in the current log file */
+
 static inline int64_t
 dbg_calc_new_credits (dbgmsg_state_t *dbgstate)
 {
@@ -67,10 +74,82 @@ dbg_check_credits (dbgmsg_state_t *dbgstate)
     return 1;
 }
 
+static void
+dbgmsg_fwrite (const void *data, size_t len)
+{
+    if (fwrite(data, 1, len, log_fd) == len)
+        log_fsize += len;
+}
+
+/* Name of log file 'idx': <name>, <name>.1, <name>.2 ... */
+static void
+dbgmsg_segment_name (char *str, size_t size, int idx)
+{
+    if (idx == 0)
+        snprintf(str, size, "%s", dbgmsg_globals.log_fname);
+    else
+        snprintf(str, size, "%s.%d", dbgmsg_globals.log_fname, idx);
+}
+
+/* Open the log file, appending; binary files start with the header */
+static int
+dbgmsg_fstart (const char *mode)
+{
+    log_fd = fopen(dbgmsg_globals.log_fname, mode);
+    if (log_fd == NULL)
+        return -1;
+    fseek(log_fd, 0, SEEK_END);
+    long pos = ftell(log_fd);
+    log_fsize = (pos > 0) ? pos : 0;
+    if (dbgmsg_globals.log_binary && (log_fsize == 0)) {
+        uint16_t version = DBGMSG_BIN_VERSION;
+        dbgmsg_fwrite(DBGMSG_BIN_MAGIC, 6);
+        dbgmsg_fwrite(&version, sizeof(version));
+    }
+    return 0;
+}
+
+/* Start a new log file once the current one is full (--log-max-size) */
+static void
+dbgmsg_rotate (void)
+{
+    char from[PATH_MAX], to[PATH_MAX];
+    int idx;
+    fclose(log_fd);
+    for (idx = dbgmsg_globals.log_segments - 1 ; idx > 0 ; idx--) {
+        dbgmsg_segment_name(from, sizeof(from), idx - 1);
+        dbgmsg_segment_name(to, sizeof(to), idx);
+        /* Fails for segments not written yet */
+        rename(from, to);
+    }
+    if (dbgmsg_fstart("w") < 0)
+        fprintf(stderr, "ERROR: cannot start new log file, logging stops\n");
+}
+
+static void
+dbgmsg_write_bin (int level, const char *msg, pkt_t pkt)
+{
+    dbgmsg_bin_hdr_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.type = DBGMSG_BIN_T_MSG;
+    hdr.level = level;
+    hdr.msglen = strlen(msg);
+    if ((pkt.mbuf != NULL) && (dbgmsg_globals.log_packets)) {
+        hdr.mbuf = (uintptr_t) pkt.mbuf;
+        int len = min(dbgmsg_globals.log_pkt_len, pkt_length(pkt));
+        hdr.pktlen = min(len, 2048);
+    }
+    hdr.size = sizeof(hdr) + hdr.msglen + hdr.pktlen;
+    dbgmsg_fwrite(&hdr, sizeof(hdr));
+    dbgmsg_fwrite(msg, hdr.msglen);
+    dbgmsg_fwrite(pkt.eth, hdr.pktlen);
+}
+
 void f_dbgmsg (dbgmsg_state_t *dbgstate,
     int level, pkt_t pkt, const char *fmt, ...)
 {
     const int max_pkt_size_log_len = 2048;
+    char msg[2048];
     char str[256 + 3 * max_pkt_size_log_len];
     int n = 0;
 
@@ -80,38 +159,47 @@ void f_dbgmsg (dbgmsg_state_t *dbgstate,
     if (dbg_check_credits(dbgstate) == 0)
         return;
 
-    const char *lvlstr;
-    switch (level) {
-        case DEBUG:  lvlstr = "D"; break;
-        case INFO:   lvlstr = "I"; break;
-        case WARN:   lvlstr = "W"; break;
-        case CONF:   lvlstr = "C"; break;
-        case ERROR:  lvlstr = "E"; break;
-        default:     lvlstr = "?"; break;
-    }
-    n += sprintf(&str[n], "%s ", lvlstr);
-
     va_list ap;
     va_start(ap, fmt);
-    int rc = vsnprintf(&str[n], 2048, fmt, ap);
+    vsnprintf(msg, sizeof(msg), fmt, ap);
     va_end(ap);
-    n += min(2048, rc);
 
-    n += sprintf(&str[n], "\n");
-
-    if ((pkt.mbuf != NULL) && (dbgmsg_globals.log_packets)) {
-        n += sprintf(&str[n], "-  %18p  ", pkt.mbuf);
-        int i;
-        uint8_t *ba = (uint8_t *) pkt.eth;
-        int len = min(dbgmsg_globals.log_pkt_len, pkt_length(pkt));
-        len = min(len, max_pkt_size_log_len);
-        for (i = 0 ; i < len ; i++)
-            n += sprintf(&str[n], " %02x", ba[i]);
-        n += sprintf(&str[n], "\n");
+    if (!dbgmsg_globals.log_binary) {
+        const char *lvlstr;
+        switch (level) {
+            case DEBUG:  lvlstr = "D"; break;
+            case INFO:   lvlstr = "I"; break;
+            case WARN:   lvlstr = "W"; break;
+            case CONF:   lvlstr = "C"; break;
+            case ERROR:  lvlstr = "E"; break;
+            default:     lvlstr = "?"; break;
+        }
+        n += sprintf(&str[n], "%s %s\n", lvlstr, msg);
+
+        if ((pkt.mbuf != NULL) && (dbgmsg_globals.log_packets)) {
+            n += sprintf(&str[n], "-  %18p  ", pkt.mbuf);
+            int i;
+            uint8_t *ba = (uint8_t *) pkt.eth;
+            int len = min(dbgmsg_globals.log_pkt_len, pkt_length(pkt));
+            len = min(len, max_pkt_size_log_len);
+            for (i = 0 ; i < len ; i++)
+                n += sprintf(&str[n], " %02x", ba[i]);
+            n += sprintf(&str[n], "\n");
+        }
     }
 
-    fprintf(log_fd, "%s", str);
-    fflush(log_fd);
+    rte_spinlock_lock(&log_lock);
+    if (log_fd != NULL) {
+        if (dbgmsg_globals.log_binary)
+            dbgmsg_write_bin(level, msg, pkt);
+        else
+            dbgmsg_fwrite(str, n);
+        fflush(log_fd);
+        if ((dbgmsg_globals.log_max_size > 0)
+                && (log_fsize >= dbgmsg_globals.log_max_size))
+            dbgmsg_rotate();
+    }
+    rte_spinlock_unlock(&log_lock);
 }
 
 void dbgmsg_hexdump (void *data, int len)
@@ -129,24 +217,37 @@ void dbgmsg_init (void)
     dbgmsg_globals.log_level = INFO;
     dbgmsg_globals.log_packets = 0;
     dbgmsg_globals.log_pkt_len = 14 + 20 + 8;
+    dbgmsg_globals.log_segments = DBGMSG_DEFAULT_SEGMENTS;
+    rte_spinlock_init(&log_lock);
 }
 
 int dbgmsg_fopen (const char *fname)
 {
     if (log_fd != NULL)
         fclose(log_fd);
-    log_fd = fopen(fname, "a");
-    if (log_fd == NULL) {
+    dbgmsg_globals.log_fname = fname;
+    if (dbgmsg_fstart("a") < 0) {
         fprintf(stderr, "ERROR: faild to open %s\n", fname);
         return -1;
     }
-    fprintf(log_fd, "\n\n----------\n");
+    if (dbgmsg_globals.log_binary) {
+        dbgmsg_bin_hdr_t hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.size = sizeof(hdr);
+        hdr.type = DBGMSG_BIN_T_SESSION;
+        dbgmsg_fwrite(&hdr, sizeof(hdr));
+    } else {
+        dbgmsg_fwrite("\n\n----------\n", 13);
+    }
     fflush(log_fd);
     return 0;
 }
 
 void dbgmsg_close (void)
 {
+    if (log_fd == NULL)
+        return;
     fflush(log_fd);
     fclose(log_fd);
+    log_fd = NULL;
 }
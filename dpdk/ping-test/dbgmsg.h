@@ -13,10 +13,48 @@ typedef struct {
     int log_level;
     int log_packets;
     int log_pkt_len;
+    const char *log_fname;  /* Opened once the options are parsed */
+    int log_binary;         /* Binary records (see route/decode-log.py) */
+    uint64_t log_max_size;  /* Bytes per log file, 0: no limit */
+    int log_segments;       /* Log files kept, the current one included */
 } dbgmsg_globals_t;
 
 extern dbgmsg_globals_t dbgmsg_globals;
 
+/*
+ * Log rotation (--log-max-size): once the log file reaches the size,
+ * it is renamed to <name>.1, <name>.1 to <name>.2 and so on, keeping
+ * --log-segments files in all, and a new file is started.
+ */
+#define DBGMSG_DEFAULT_SEGMENTS 4
+
+/*
+ * Binary log format (--log-binary), the same as route's: host byte
+ * order, a file header (DBGMSG_BIN_MAGIC and the version), then
+ * records of a header, the message text and the packet bytes. There
+ * is no port column, so DBGMSG_BIN_F_PORTCOL is never set.
+ */
+#define DBGMSG_BIN_MAGIC        "RTLOG\0"
+#define DBGMSG_BIN_VERSION      1
+
+#define DBGMSG_BIN_T_MSG        1
+#define DBGMSG_BIN_T_SESSION    2   /* Log opened ("----------") */
+
+#define DBGMSG_BIN_F_PORT       (1 << 0)    /* 'port' is valid */
+#define DBGMSG_BIN_F_PORTCOL    (1 << 1)    /* Text has a port column */
+
+typedef struct __attribute__ ((__packed__)) {
+    uint16_t size;      /* Record size, this header included */
+    uint8_t type;       /* DBGMSG_BIN_T_xxx */
+    uint8_t level;
+    uint8_t flags;      /* DBGMSG_BIN_F_xxx */
+    uint8_t reserved;
+    uint16_t port;
+    uint16_t msglen;
+    uint16_t pktlen;
+    uint64_t mbuf;      /* Shown in the packet dump line */
+} dbgmsg_bin_hdr_t;
+
 typedef struct {
     int64_t maxcredits;
     int64_t speed;
@@ -1,5 +1,6 @@
 #include <strings.h>
 #include <stdio.h>
+#include <ctype.h>
 #include <stdint.h>
 #include <arpa/inet.h>
 #include <getopt.h>
@@ -9,6 +10,7 @@
 #include "tables.h"
 #include "functions.h"
 #include "dbgmsg.h"
+#include "capture.h"
 
 typedef struct {
     const char *name;
@@ -374,6 +376,8 @@ add_static_arp_entry (const char *argstr)
     }
 
     rt_port_info_t *pi = rt_port_lookup(prtidx);
+    rt_ipv4_ar_t *ar = rt_ipv4_ar_find_or_create(pi, nhipa);
+    ar->flags |= RT_AR_F_STATIC;
     rt_ipv4_ar_learn(pi, nhipa, hwaddr);
 
     dbgmsg(CONF, nopkt, "Static ARP Entry (%u) %s -> %s", prtidx,
@@ -389,8 +393,10 @@ static int
 parse_port_pinning (const char *arg)
 {
     // Format: --pin 1:1,2 --pin <port>:<rx lcore>,<tx lcore>
+    //         --pin 1:1+2+3,4 (one RX queue per listed lcore)
     char argstr[128];
     strncpy(argstr, arg, 127);
+    argstr[127] = 0;
     /* Character Position Pointers */
     char *cpp_colon = index(argstr, ':');
     char *cpp_comma = index(argstr, ',');
@@ -407,9 +413,21 @@ parse_port_pinning (const char *arg)
     if (cpp_comma != NULL) {
         *cpp_comma = 0;
     }
-    pi->rx_lcore = strtol(&cpp_colon[1], &endstr, 10);
-    if (*endstr != '\0')
-        goto ParseError;
+    /* RX lcores, '+' separated */
+    const char *cp = &cpp_colon[1];
+    int qcnt = 0;
+    for (;;) {
+        if (qcnt >= MAX_RX_QUEUE_PER_PORT)
+            goto ParseError;
+        pi->rxq_lcore[qcnt++] = strtol(cp, &endstr, 10);
+        if ((endstr == cp) || ((*endstr != '\0') && (*endstr != '+')))
+            goto ParseError;
+        if (*endstr == '\0')
+            break;
+        cp = &endstr[1];
+    }
+    pi->rx_q_count = qcnt;
+    pi->rx_lcore = pi->rxq_lcore[0];
     if (cpp_comma != NULL) {
         pi->tx_lcore = strtol(&cpp_comma[1], &endstr, 10);
         if (*endstr != '\0')
@@ -423,6 +441,104 @@ parse_port_pinning (const char *arg)
     return -1;
 }
 
+static int
+parse_rx_queues (const char *arg)
+{
+    // Format: --rx-queues <port>:<count>
+    char *endstr;
+    int prtidx = strtol(arg, &endstr, 10);
+    if ((*endstr != ':') || (prtidx < 0) || (prtidx >= RT_MAX_PORT_COUNT))
+        goto ParseError;
+    const char *cp = &endstr[1];
+    int qcnt = strtol(cp, &endstr, 10);
+    if ((endstr == cp) || (*endstr != '\0')
+            || (qcnt < 1) || (qcnt > MAX_RX_QUEUE_PER_PORT))
+        goto ParseError;
+    rt_port_lookup(prtidx)->rx_q_count = qcnt;
+    return 0;
+  ParseError:
+    fprintf(stderr, "ERROR: could not parse '%s'\n", arg);
+    return -1;
+}
+
+/*
+ * RSS key: hexadecimal bytes, or 'symmetric' for a key that hashes
+ * both directions of a flow to the same queue.
+ */
+static int
+parse_rss_key (const char *arg)
+{
+    int len = 0;
+    if (strcmp(arg, "symmetric") == 0) {
+        for (len = 0 ; len < 40 ; len += 2) {
+            g.rss_key[len] = 0x6d;
+            g.rss_key[len + 1] = 0x5a;
+        }
+        g.rss_key_len = len;
+        return 0;
+    }
+    const char *cp = arg;
+    while ((cp[0] != '\0') && (len < RT_RSS_KEY_MAX)) {
+        char hex[3] = { cp[0], cp[1], '\0' };
+        char *endstr;
+        if (!isxdigit(cp[0]) || !isxdigit(cp[1]))
+            goto ParseError;
+        g.rss_key[len++] = strtoul(hex, &endstr, 16);
+        cp += 2;
+        if (*cp == ':')
+            cp++;
+    }
+    if ((cp[0] != '\0') || (len == 0))
+        goto ParseError;
+    g.rss_key_len = len;
+    return 0;
+  ParseError:
+    fprintf(stderr, "ERROR: could not parse RSS key '%s'\n", arg);
+    return -1;
+}
+
+/*
+ * Capture points: rx, miss, disc (all discards) or the discard
+ * reasons, separated by commas.
+ */
+static int
+parse_capture_points (const char *arg)
+{
+    char str[128];
+    char *tok, *save = NULL;
+    snprintf(str, sizeof(str), "%s", arg);
+    g.capture_points = 0;
+    for (tok = strtok_r(str, ",", &save) ; tok != NULL
+            ; tok = strtok_r(NULL, ",", &save)) {
+        int idx;
+        if (strcmp(tok, "rx") == 0) {
+            g.capture_points |= RT_CAP_RX;
+            continue;
+        }
+        if (strcmp(tok, "miss") == 0) {
+            g.capture_points |= RT_CAP_MISS;
+            continue;
+        }
+        if (strcmp(tok, "disc") == 0) {
+            g.capture_points |= RT_CAP_DISC_ALL;
+            continue;
+        }
+        for (idx = 0 ; idx < RT_DISC_REASONS ; idx++) {
+            if (strcmp(tok, rt_cap_disc_names[idx]) == 0)
+                break;
+        }
+        if (idx == RT_DISC_REASONS)
+            goto ParseError;
+        g.capture_points |= RT_CAP_DISC(idx);
+    }
+    if (g.capture_points == 0)
+        goto ParseError;
+    return 0;
+  ParseError:
+    fprintf(stderr, "ERROR: could not parse capture points '%s'\n", arg);
+    return -1;
+}
+
 /* display usage */
 static void
 usage (const char *prgname)
@@ -432,8 +548,16 @@ usage (const char *prgname)
 "  -h --help                - print this help\n"
 "  --log-packets            - log packets in log file\n"
 "  --log-pkt-len <int>      - Maximum packet size to capture in log\n"
+"                             (at most 240)\n"
 "  --no-statistics          - do not print statistics\n"
 "  --ping-nexthops          - ping all route-nexthops\n"
+"  --direct-tx              - one TX queue per lcore and port, no TX ring\n"
+"  --no-bulk-free           - free discarded packets one by one\n"
+"  --tx-drain loop|latency|idle\n"
+"                           - when to send partial TX batches (default loop)\n"
+"  --tx-drain-us <usec>     - TX latency budget (default %u)\n"
+"  --tx-hold-us <usec>      - retry packets a full TX queue refused for\n"
+"                             up to this long (default %u, 0: drop)\n"
 "  -p --port-bitmap <port bitmap>\n"
 "                           - hexadecimal bitmask of ports\n"
 "  -q <queue count>         - number of queue (=ports) per lcore (default is 1)\n"
@@ -446,10 +570,57 @@ usage (const char *prgname)
 "  --route [<rdidx>#]<IPv4 addr>/<prefix length>@[<rdidx>#]<next hop IPv4 addr>[!<option>]\n"
 "                           - add route\n"
 "  --log-file <file name>   - specify log-file\n"
-"  --pin <port>:<rx lcore>[,<tx lcore>]\n"
-"                           - static lcore-port pinning\n"
+"  --log-binary             - write binary log records (see decode-log.py)\n"
+"  --log-max-size <MB>      - start a new log file at this size\n"
+"                             (default 0: no limit)\n"
+"  --log-segments <n>       - log files kept with --log-max-size\n"
+"                             (default %u)\n"
+"  --capture-file <file>    - write captured packets to a pcapng file\n"
+"  --capture rx|miss|disc|<discard reason>[,...]\n"
+"                           - what to capture (default rx)\n"
+"  --capture-ports <port bitmap>\n"
+"                           - hexadecimal bitmask of the receive ports\n"
+"                             captured on (default all)\n"
+"  --capture-sample <n>     - capture 1 in n of the selected packets\n"
+"  --capture-snaplen <bytes>\n"
+"                           - bytes kept per packet (default %u, max %u)\n"
+"  --pin <port>:<rx lcore>[+<rx lcore>...][,<tx lcore>]\n"
+"                           - static lcore-port pinning, one RX queue\n"
+"                             per RX lcore\n"
+"  --rx-queues <port>:<n>   - number of RX queues (spread over lcores)\n"
+"  --rss-hash ip|l4|ip-l4   - RSS hash fields (default ip-l4)\n"
+"  --rss-key <hex>|symmetric\n"
+"                           - RSS hash key (default: driver's)\n"
+"  --rx-balance <msec>      - move RX queues off saturated lcores,\n"
+"                             checking this often (default 0: never)\n"
+"  --power                  - pause, sleep and wait for RX interrupts\n"
+"                             when idle instead of busy polling\n"
+"  --power-intr-ms <msec>   - idle time before waiting for interrupts\n"
+"                             (default %u, 0: never)\n"
+"  --ctrl-lcore <lcore>     - run the slow path (ARP, DHCP, ICMP, direct\n"
+"                             table misses) on this lcore only\n"
+"  --punt-rate <pkts/s>     - slow path packets each lcore may hand to\n"
+"                             the control lcore (default %u, 0: no limit)\n"
 "  --rand-disc-level <val>  - discard rate (percent) for RANDDISC routes\n"
-    "\n");
+"  --dt-size <entries>      - direct table size (default %u)\n"
+"  --dt-budget <entries>    - direct table entries kept before evicting\n"
+"                             (default 3/4 of the size)\n"
+"  --dt-idle <sec>          - evict unused direct table entries\n"
+"                             (default %u, 0: never)\n"
+"  --dump-dt-histogram      - print direct table occupancy with statistics\n"
+"  --top-counters <n>       - print the n busiest routes and flows\n"
+"                             with statistics (max %u)\n"
+"  --arp-queue-depth <n>    - packets held per unresolved next hop\n"
+"                             (default %u, max %u)\n"
+"  --arp-reachable <sec>    - ARP entry lifetime without refresh (default %u)\n"
+"  --arp-stale <sec>        - keep using a stale ARP entry while\n"
+"                             re-resolving it (default %u)\n"
+    "\n", RT_TX_DRAIN_DEFAULT_US, RT_TX_HOLD_DEFAULT_US,
+    DBGMSG_DEFAULT_SEGMENTS, RT_CAP_DEFAULT_SNAPLEN, RT_CAP_MAX_SNAPLEN,
+    RT_PWR_INTR_DEFAULT_MS, RT_PUNT_DEFAULT_RATE,
+    RT_DT_DEFAULT_SIZE, RT_DT_DEFAULT_IDLE, RT_CNT_TOP_MAX,
+    RT_AR_DEFAULT_QUEUE_DEPTH, RT_AR_MAX_QUEUE_DEPTH,
+    RT_AR_DEFAULT_REACHABLE, RT_AR_DEFAULT_STALE);
 }
 
 static uint64_t
@@ -469,6 +640,109 @@ rt_parse_portmask (const char *portmask)
     return pm;
 }
 
+/*
+ * Find the port mask ahead of the full parse: the tables the other
+ * options fill in are allocated next to the enabled ports.
+ */
+uint64_t
+rt_peek_portmask (int argc, char **argv)
+{
+    int i;
+    for (i = 1 ; i < argc ; i++) {
+        const char *arg = argv[i];
+        const char *val = NULL;
+        if ((strcmp(arg, "-p") == 0) || (strcmp(arg, "--port-bitmap") == 0))
+            val = (i + 1 < argc) ? argv[i + 1] : NULL;
+        else if (strncmp(arg, "--port-bitmap=", 14) == 0)
+            val = &arg[14];
+        else if ((strncmp(arg, "-p", 2) == 0) && (arg[2] != '-'))
+            val = &arg[2];
+        if (val != NULL)
+            return rt_parse_portmask(val);
+    }
+    return 0;
+}
+
+/*
+ * Value of option 'name' at argv[*idx] ("--name value" or "--name=value"),
+ * or NULL
+ */
+static const char *
+rt_peek_option (int argc, char **argv, int *idx, const char *name)
+{
+    const char *arg = argv[*idx];
+    size_t len = strlen(name);
+    if (strncmp(arg, name, len) != 0)
+        return NULL;
+    if (arg[len] == '=')
+        return &arg[len + 1];
+    if ((arg[len] == '\0') && (*idx + 1 < argc))
+        return argv[++(*idx)];
+    return NULL;
+}
+
+/*
+ * Decimal number in [min, max], or -1
+ */
+static int64_t
+rt_parse_log_number (const char *arg, int64_t min, int64_t max)
+{
+    char *end = NULL;
+    long long n;
+
+    if (!isdigit((unsigned char) arg[0]))
+        return -1;
+    n = strtoll(arg, &end, 10);
+    if ((end == NULL) || (*end != '\0'))
+        return -1;
+    if ((n < min) || (n > max))
+        return -1;
+
+    return n;
+}
+
+/*
+ * Open the log file ahead of the full parse, so that it gets the
+ * records logged while the options are applied (routes, static ARP
+ * entries). The file options must all be known to open it.
+ */
+static int
+rt_peek_log_options (int argc, char **argv)
+{
+    const char *fname = NULL;
+    const char *val;
+    int i;
+    for (i = 1 ; i < argc ; i++) {
+        if (strcmp(argv[i], "--log-binary") == 0) {
+            dbgmsg_globals.log_binary = 1;
+        } else if ((val = rt_peek_option(argc, argv, &i, "--log-file"))
+                != NULL) {
+            fname = val;
+        } else if ((val = rt_peek_option(argc, argv, &i, "--log-max-size"))
+                != NULL) {
+            /* The size in bytes must fit an off_t */
+            int64_t mb = rt_parse_log_number(val, 0, INT64_MAX >> 20);
+            if (mb < 0) {
+                fprintf(stderr, "ERROR: invalid log file size %s\n", val);
+                return -1;
+            }
+            dbgmsg_globals.log_max_size = (uint64_t) mb << 20;
+        } else if ((val = rt_peek_option(argc, argv, &i, "--log-segments"))
+                != NULL) {
+            int64_t n = rt_parse_log_number(val, 1, 1000);
+            if (n < 0) {
+                fprintf(stderr, "ERROR: invalid number of log segments"
+                    " %s\n", val);
+                return -1;
+            }
+            dbgmsg_globals.log_segments = (int) n;
+        }
+    }
+    if ((fname != NULL) && (dbgmsg_fopen(fname) < 0))
+        return -1;
+    return 0;
+}
+
 static unsigned int
 rt_parse_nqueue (const char *q_arg)
 {
@@ -535,11 +809,43 @@ rt_parse_args (int argc, char **argv)
         { "rand-disc-level", required_argument, NULL, 1009},
         { "log-packets", no_argument, &dbgmsg_globals.log_packets, 1},
         { "log-pkt-len", required_argument, NULL, 1010},
+        { "dt-size", required_argument, NULL, 1011},
+        { "dump-dt-histogram", no_argument, &g.dt_histogram, 1},
+        { "top-counters", required_argument, NULL, 1012},
+        { "arp-queue-depth", required_argument, NULL, 1013},
+        { "arp-reachable", required_argument, NULL, 1014},
+        { "arp-stale", required_argument, NULL, 1015},
+        { "dt-budget", required_argument, NULL, 1016},
+        { "dt-idle", required_argument, NULL, 1017},
         { "no-statistics", no_argument, &g.print_statistics, 0},
         { "ping-nexthops", no_argument, &g.ping_nexthops, 1},
+        { "direct-tx", no_argument, &g.direct_tx, 1},
+        { "no-bulk-free", no_argument, &g.bulk_free, 0},
+        { "tx-drain", required_argument, NULL, 1018},
+        { "tx-drain-us", required_argument, NULL, 1019},
+        { "tx-hold-us", required_argument, NULL, 1020},
+        { "rx-queues", required_argument, NULL, 1021},
+        { "rss-hash", required_argument, NULL, 1022},
+        { "rss-key", required_argument, NULL, 1023},
+        { "rx-balance", required_argument, NULL, 1024},
+        { "power", no_argument, &g.power, 1},
+        { "power-intr-ms", required_argument, NULL, 1025},
+        { "ctrl-lcore", required_argument, NULL, 1026},
+        { "punt-rate", required_argument, NULL, 1027},
+        { "log-binary", no_argument, &dbgmsg_globals.log_binary, 1},
+        { "log-max-size", required_argument, NULL, 1028},
+        { "log-segments", required_argument, NULL, 1029},
+        { "capture-file", required_argument, NULL, 1030},
+        { "capture", required_argument, NULL, 1031},
+        { "capture-ports", required_argument, NULL, 1032},
+        { "capture-sample", required_argument, NULL, 1033},
+        { "capture-snaplen", required_argument, NULL, 1034},
         { NULL, 0, 0, 0}
     };
 
+    if (rt_peek_log_options(argc, argv) < 0)
+        return -1;
+
     argvopt = argv;
 
     while ((opt = getopt_long(argc, argvopt, "hp:q:T:",
@@ -585,8 +891,10 @@ rt_parse_args (int argc, char **argv)
             rc = parse_ipv4_route(optarg);
             break;
 
-        case 1003:
-            rc = dbgmsg_fopen(optarg);
+        case 1003: /* --log-file */
+        case 1028: /* --log-max-size */
+        case 1029: /* --log-segments */
+            /* Taken by rt_peek_log_options(), the log is open already */
             break;
 
         case 1004:
@@ -615,6 +923,143 @@ rt_parse_args (int argc, char **argv)
 
          case 1010: /* --log-pkt-len */
             dbgmsg_globals.log_pkt_len = strtol(optarg, NULL, 10);
+            if ((dbgmsg_globals.log_pkt_len < 0)
+                    || (dbgmsg_globals.log_pkt_len > DBGMSG_PKT_LEN)) {
+                fprintf(stderr, "ERROR: packet log length %s out of range"
+                    " (0..%d)\n", optarg, DBGMSG_PKT_LEN);
+                rc = -1;
+            }
+            break;
+
+        case 1011: /* --dt-size */
+            g.dt_size = strtoul(optarg, NULL, 10);
+            if (g.dt_size == 0) {
+                errmsg = "invalid direct table size";
+            }
+            break;
+
+        case 1012: /* --top-counters */
+            g.top_counters = strtol(optarg, NULL, 10);
+            if ((g.top_counters < 0) || (g.top_counters > RT_CNT_TOP_MAX)) {
+                errmsg = "invalid top counter count";
+            }
+            break;
+
+        case 1013: /* --arp-queue-depth */
+            g.ar_queue_depth = strtol(optarg, NULL, 10);
+            if ((g.ar_queue_depth < 1)
+                    || (g.ar_queue_depth > RT_AR_MAX_QUEUE_DEPTH)) {
+                errmsg = "invalid ARP queue depth";
+            }
+            break;
+
+        case 1014: /* --arp-reachable */
+            g.ar_reachable = strtoul(optarg, NULL, 10);
+            if (g.ar_reachable == 0) {
+                errmsg = "invalid ARP reachable time";
+            }
+            break;
+
+        case 1015: /* --arp-stale */
+            g.ar_stale = strtoul(optarg, NULL, 10);
+            break;
+
+        case 1016: /* --dt-budget */
+            g.dt_budget = strtoul(optarg, NULL, 10);
+            if (g.dt_budget == 0) {
+                errmsg = "invalid direct table budget";
+            }
+            break;
+
+        case 1017: /* --dt-idle */
+            g.dt_idle = strtoul(optarg, NULL, 10);
+            break;
+
+        case 1018: /* --tx-drain */
+            if (strcmp(optarg, "loop") == 0)
+                g.tx_drain = RT_TX_DRAIN_LOOP;
+            else if (strcmp(optarg, "latency") == 0)
+                g.tx_drain = RT_TX_DRAIN_LATENCY;
+            else if (strcmp(optarg, "idle") == 0)
+                g.tx_drain = RT_TX_DRAIN_IDLE;
+            else
+                errmsg = "invalid TX drain policy";
+            break;
+
+        case 1019: /* --tx-drain-us */
+            g.tx_drain_us = strtoul(optarg, NULL, 10);
+            break;
+
+        case 1020: /* --tx-hold-us */
+            g.tx_hold_us = strtoul(optarg, NULL, 10);
+            break;
+
+        case 1021: /* --rx-queues */
+            rc = parse_rx_queues(optarg);
+            break;
+
+        case 1022: /* --rss-hash */
+            if (strcmp(optarg, "ip") == 0)
+                g.rss_hash = RT_RSS_IP;
+            else if (strcmp(optarg, "l4") == 0)
+                g.rss_hash = RT_RSS_L4;
+            else if (strcmp(optarg, "ip-l4") == 0)
+                g.rss_hash = RT_RSS_IP_L4;
+            else
+                errmsg = "invalid RSS hash";
+            break;
+
+        case 1023: /* --rss-key */
+            rc = parse_rss_key(optarg);
+            break;
+
+        case 1024: /* --rx-balance */
+            g.rx_balance_ms = strtoul(optarg, NULL, 10);
+            break;
+
+        case 1025: /* --power-intr-ms */
+            g.power_intr_ms = strtoul(optarg, NULL, 10);
+            break;
+
+        case 1026: /* --ctrl-lcore */
+            g.ctrl_lcore = strtol(optarg, NULL, 10);
+            if ((g.ctrl_lcore < 0) || (g.ctrl_lcore >= RTE_MAX_LCORE)) {
+                errmsg = "invalid control lcore";
+            }
+            break;
+
+        case 1027: /* --punt-rate */
+            g.punt_rate = strtoul(optarg, NULL, 10);
+            break;
+
+        case 1030: /* --capture-file */
+            g.capture_fname = optarg;
+            break;
+
+        case 1031: /* --capture */
+            rc = parse_capture_points(optarg);
+            break;
+
+        case 1032: /* --capture-ports */
+            g.capture_ports = rt_parse_portmask(optarg);
+            if (g.capture_ports == (uint64_t) -1) {
+                errmsg = "invalid capture port bitmap";
+            }
+            break;
+
+        case 1033: /* --capture-sample */
+            g.capture_sample = strtoul(optarg, NULL, 10);
+            if (g.capture_sample == 0) {
+                errmsg = "invalid capture sampling rate";
+            }
+            break;
+
+        case 1034: /* --capture-snaplen */
+            g.capture_snaplen = strtoul(optarg, NULL, 10);
+            if ((g.capture_snaplen < 14)
+                    || (g.capture_snaplen > RT_CAP_MAX_SNAPLEN)) {
+                errmsg = "invalid capture snap length";
+            }
             break;
 
         /* long options */
@@ -1,5 +1,7 @@
 #include <string.h>
 
+#include <rte_cycles.h>
+
 #include "defines.h"
 #include "tables.h"
 #include "pktutils.h"
@@ -47,16 +49,21 @@ rt_arp_pkt_hton (rt_pkt_arp_t *app, void *pkt)
     memcpy(pkt, &ap, sizeof(ap));
 }
 
+/*
+ * Send all packets that were waiting for this address, a burst at a time
+ */
 static inline void
 rt_ar_flush_packet (rt_ipv4_ar_t *ar)
 {
-    rt_pkt_t pkt;
-    int rc = rt_ipv4_ar_get_pkt(&pkt, ar);
-    if (rc == 1) {
-        /* Update the MAC addresses */
-        rt_pkt_set_hw_addrs(pkt, ar->pi, ar->hwaddr);
-        dbgmsg(INFO, pkt, "Flush packet from AR entry");
-        rt_pkt_send(pkt, ar->pi);
+    rt_pkt_t pkts[MAX_PKT_BURST];
+    int cnt, idx;
+    while ((cnt = rt_ipv4_ar_get_pkts(ar, pkts, MAX_PKT_BURST)) > 0) {
+        dbgmsg(INFO, nopkt, "Flush %d packet(s) from AR entry", cnt);
+        for (idx = 0 ; idx < cnt ; idx++) {
+            /* Update the MAC addresses */
+            rt_pkt_set_hw_addrs(pkts[idx], ar->pi, ar->hwaddr);
+            rt_pkt_send(pkts[idx], ar->pi);
+        }
     }
 }
 
@@ -239,7 +246,7 @@ rt_arp_send_request (rt_pkt_t pkt, rt_port_info_t *pi,
     rt_pkt_send(pkt, pi);
 }
 
-static inline void
+void
 rt_arp_request (rt_port_info_t *pi, rt_ipv4_addr_t ipda)
 {
     /* Create new packet for ARP request */
@@ -279,12 +286,20 @@ rt_arp_generate (rt_pkt_t pkt, rt_ipv4_addr_t ipda, rt_lpm_t *rt)
     rt_port_info_t *pi = rt->pi;
     int rc;
 
-    rt_ipv4_ar_t *ar = rt_ipv4_ar_find_or_create(pi, ipda);
+    /* Only the first packet to a new next hop creates the entry */
+    rt_ipv4_ar_t *ar = rt_ipv4_ar_lookup(pi, ipda);
+    if (ar == NULL)
+        ar = rt_ipv4_ar_find_or_create(pi, ipda);
     assert(ar != NULL);
     rc = rt_ipv4_ar_set_pkt(pkt, ar);
-    if (rc != 1) {
-        rt_pkt_discard(pkt, RT_DISC_DROP);
+    if (rc == 0) {
+        rt_pkt_discard(pkt, RT_DISC_ARPQ);
     }
 
-    rt_arp_request(pi, ipda);
+    /* The entry's timer repeats the request until the reply arrives
+     * or the queue times out; packets arriving in between ask again
+     * at most once a second (shared with the timer) */
+    if (rt_ipv4_ar_request_due(ar, rte_get_timer_cycles())) {
+        rt_arp_request(pi, ipda);
+    }
 }
@@ -0,0 +1,229 @@
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <rte_common.h>
+#include <rte_lcore.h>
+
+#include "defines.h"
+#include "port.h"
+#include "stats.h"
+#include "numa.h"
+#include "rcu.h"
+#include "dbgmsg.h"
+#include "balance.h"
+
+rt_queue_list_t *rt_rx_queue_list[RTE_MAX_LCORE];
+
+/* Per-lcore load over the last interval */
+typedef struct {
+    uint64_t polls;
+    uint64_t full;      /* Polls returning a full burst */
+    uint64_t busy;      /* Polls returning packets */
+    uint64_t pkts;
+    uint64_t port_pkts[RT_MAX_PORT_COUNT];
+} rt_balance_load_t;
+
+/* Queue being moved */
+typedef struct {
+    rt_port_index_t prtidx;
+    rt_queue_index_t queidx;
+    unsigned src;
+    unsigned dst;
+    uint64_t epoch;     /* 'src' has dropped the queue past this epoch */
+} rt_balance_move_t;
+
+static volatile uint8_t rt_balance_active[RTE_MAX_LCORE];
+static rt_load_stats_t rt_balance_prev[RTE_MAX_LCORE][RT_MAX_PORT_COUNT];
+static rt_balance_load_t rt_balance_load[RTE_MAX_LCORE];
+static rt_balance_move_t rt_balance_move;
+static int rt_balance_busy;     /* A move is in progress */
+static int rt_balance_settle;   /* Skip one interval after a move */
+static uint64_t rt_balance_next;
+static uint64_t rt_balance_moves;
+
+/*
+ * Build and publish the RX queue list of the calling lcore. Only
+ * lcores that did this take part in rebalancing.
+ */
+void
+rt_balance_register (unsigned lcore)
+{
+    rt_queue_list_t *ql = create_thread_rx_queue_list(lcore);
+    rt_rcu_assign_pointer(rt_rx_queue_list[lcore], ql);
+    rt_balance_active[lcore] = 1;
+}
+
+/* Rebuild the list of 'lcore' from the port table and publish it */
+static void
+rt_balance_publish (unsigned lcore)
+{
+    rt_queue_list_t *old = rt_rx_queue_list[lcore];
+    rt_queue_list_t *ql = create_thread_rx_queue_list(lcore);
+    rt_rcu_assign_pointer(rt_rx_queue_list[lcore], ql);
+    rt_rcu_defer_free(old);
+    rt_port_log_queue_list(lcore, ql);
+}
+
+static void
+rt_balance_collect (void)
+{
+    unsigned lcore;
+    int idx;
+    for (lcore = 0 ; lcore < RTE_MAX_LCORE ; lcore++) {
+        if (!rt_balance_active[lcore])
+            continue;
+        rt_balance_load_t *lp = &rt_balance_load[lcore];
+        memset(lp, 0, sizeof(*lp));
+        FOREACH_PORT(prtidx) {
+            const volatile rt_load_stats_t *ls =
+                &rt_lcore_stats[lcore].port[prtidx].ls;
+            rt_load_stats_t *pp = &rt_balance_prev[lcore][prtidx];
+            uint64_t d[LS_COUNTERS];
+            for (idx = 0 ; idx < LS_COUNTERS ; idx++) {
+                uint64_t cur = ls->cnt[idx];
+                d[idx] = cur - pp->cnt[idx];
+                pp->cnt[idx] = cur;
+            }
+            uint64_t pkts = d[LS_SINGLE] + d[LS_PKTCNT]
+                + d[LS_FULL] * MAX_PKT_BURST;
+            lp->polls += d[LS_EMPTY] + d[LS_SINGLE] + d[LS_PARTIAL]
+                + d[LS_FULL];
+            lp->busy += d[LS_SINGLE] + d[LS_PARTIAL] + d[LS_FULL];
+            lp->full += d[LS_FULL];
+            lp->port_pkts[prtidx] = pkts;
+            lp->pkts += pkts;
+        }
+    }
+}
+
+/*
+ * Pick the source lcore (saturated, with more than one queue), and
+ * the queue and destination lcore that even out the packet rates
+ * best. Destinations must be lightly loaded and on the port's socket.
+ * Returns 0 if nothing is worth moving.
+ */
+static int
+rt_balance_pick (rt_balance_move_t *mv)
+{
+    unsigned lcore, src = RTE_MAX_LCORE;
+    for (lcore = 0 ; lcore < RTE_MAX_LCORE ; lcore++) {
+        const rt_balance_load_t *lp = &rt_balance_load[lcore];
+        if (!rt_balance_active[lcore] || (lp->polls == 0))
+            continue;
+        if (lp->full * 100 < RT_BALANCE_HIGH_PCT * lp->polls)
+            continue;
+        if (rt_rx_queue_list[lcore]->count < 2)
+            continue;
+        if ((src == RTE_MAX_LCORE)
+                || (lp->pkts > rt_balance_load[src].pkts))
+            src = lcore;
+    }
+    if (src == RTE_MAX_LCORE)
+        return 0;
+
+    const rt_balance_load_t *sp = &rt_balance_load[src];
+    const rt_queue_list_t *ql = rt_rx_queue_list[src];
+    uint64_t best = UINT64_MAX;
+    int idx, jdx;
+    for (idx = 0 ; idx < ql->count ; idx++) {
+        const rt_queue_t *qp = &ql->list[idx];
+        int socket = rt_numa_port_socket(qp->prtidx);
+        /* Queues of one port on one lcore share the port's count */
+        int nq = 0;
+        for (jdx = 0 ; jdx < ql->count ; jdx++)
+            nq += (ql->list[jdx].prtidx == qp->prtidx);
+        uint64_t est = sp->port_pkts[qp->prtidx] / nq;
+        if (est == 0)
+            continue;
+        for (lcore = 0 ; lcore < RTE_MAX_LCORE ; lcore++) {
+            const rt_balance_load_t *dp = &rt_balance_load[lcore];
+            if (!rt_balance_active[lcore] || (lcore == src)
+                    || ((int) lcore == g.ctrl_lcore))
+                continue;
+            if (rt_numa_lcore_socket(lcore) != socket)
+                continue;
+            if (dp->busy * 100 >= RT_BALANCE_LOW_PCT * dp->polls
+                    && (dp->polls > 0))
+                continue;
+            if (dp->pkts + est >= sp->pkts)
+                continue;
+            uint64_t a = sp->pkts - est, b = dp->pkts + est;
+            uint64_t diff = (a > b) ? a - b : b - a;
+            if (diff < best) {
+                best = diff;
+                mv->prtidx = qp->prtidx;
+                mv->queidx = qp->queidx;
+                mv->src = src;
+                mv->dst = lcore;
+            }
+        }
+    }
+    return best != UINT64_MAX;
+}
+
+/*
+ * Second half of a move: the source lcore has passed a quiescent
+ * state since it was given a list without the queue, so the queue
+ * can be handed to the destination.
+ */
+static void
+rt_balance_handoff (rt_balance_move_t *mv)
+{
+    rt_port_info_t *pi = rt_port_lookup(mv->prtidx);
+    pi->rxq_lcore[mv->queidx] = mv->dst;
+    if (mv->queidx == 0)
+        pi->rx_lcore = mv->dst;
+    rt_balance_publish(mv->dst);
+    dbgmsg(INFO, nopkt, "RX queue p%u:q%u moved from lcore %u to %u",
+        mv->prtidx, mv->queidx, mv->src, mv->dst);
+    rt_balance_moves++;
+    rt_balance_busy = 0;
+    rt_balance_settle = 1;
+}
+
+/*
+ * Rebalancing controller, called by the master lcore from its main
+ * loop. Moves at most one queue per interval, and leaves the interval
+ * after a move out so that the load settles.
+ */
+void
+rt_balance_run (uint64_t now)
+{
+    rt_balance_move_t *mv = &rt_balance_move;
+
+    if (rt_balance_busy) {
+        uint64_t epoch = __atomic_load_n(&rt_rcu_lcore[mv->src].epoch,
+            __ATOMIC_ACQUIRE);
+        if ((epoch == 0) || (epoch >= mv->epoch))
+            rt_balance_handoff(mv);
+        return;
+    }
+
+    if ((g.rx_balance_tsc == 0) || (now < rt_balance_next))
+        return;
+    rt_balance_next = now + g.rx_balance_tsc;
+
+    rt_balance_collect();
+    if (rt_balance_settle) {
+        rt_balance_settle = 0;
+        return;
+    }
+    if (!rt_balance_pick(mv))
+        return;
+
+    /* Take the queue away from the source first */
+    rt_port_lookup(mv->prtidx)->rxq_lcore[mv->queidx] =
+        RT_PORT_LCORE_UNASSIGNED;
+    rt_balance_publish(mv->src);
+    mv->epoch = __atomic_add_fetch(&rt_rcu_epoch, 1, __ATOMIC_SEQ_CST);
+    rt_balance_busy = 1;
+}
+
+void
+rt_balance_print_stats (FILE *fd)
+{
+    if (g.rx_balance_tsc == 0)
+        return;
+    fprintf(fd, "RX queue moves: %" PRIu64 "\n", rt_balance_moves);
+}
@@ -0,0 +1,41 @@
+#ifndef __RT_BALANCE_H__
+#define __RT_BALANCE_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "port.h"
+#include "rcu.h"
+
+/*
+ * RX queue rebalancing
+ *
+ * Each lcore polls the RX queue list published for it, re-reading
+ * the pointer after every quiescent state. With --rx-balance the
+ * master lcore compares the load statistics of the lcores, and moves
+ * one RX queue from a saturated lcore (many full bursts) to the least
+ * loaded lcore on the port's socket. The handoff takes two RCU grace
+ * periods: the queue is first removed from the old lcore's list, and
+ * only once that lcore has passed a quiescent state is it added to
+ * the new lcore's list. A queue is never polled by two lcores at
+ * once; in between, packets wait in the NIC's RX ring.
+ */
+
+/* Full bursts (percent of polls) making an lcore a source */
+#define RT_BALANCE_HIGH_PCT     25
+/* Non-empty polls (percent) below which an lcore may take a queue */
+#define RT_BALANCE_LOW_PCT      50
+
+extern rt_queue_list_t *rt_rx_queue_list[RTE_MAX_LCORE];
+
+static inline const rt_queue_list_t *
+rt_balance_queue_list (unsigned lcore)
+{
+    return rt_rcu_dereference(rt_rx_queue_list[lcore]);
+}
+
+void rt_balance_register (unsigned lcore);
+void rt_balance_run (uint64_t now);
+void rt_balance_print_stats (FILE *fd);
+
+#endif
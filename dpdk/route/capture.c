@@ -0,0 +1,343 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <rte_common.h>
+#include <rte_version.h>
+#include <rte_cycles.h>
+#include <rte_debug.h>
+#include <rte_lcore.h>
+#include <rte_mbuf.h>
+#include <rte_mempool.h>
+#include <rte_memcpy.h>
+#include <rte_ring.h>
+
+#include "defines.h"
+#include "stats.h"
+#include "dbgmsg.h"
+#include "capture.h"
+
+/* Capture mbufs: the ring, what the writer holds, and lcore caches */
+#define RT_CAP_POOL_SIZE    (2 * RT_CAP_RING_SIZE - 1)
+#define RT_CAP_POOL_CACHE   32
+
+/* pcapng block types and options */
+#define PCAPNG_SHB              0x0a0d0d0a
+#define PCAPNG_IDB              0x00000001
+#define PCAPNG_EPB              0x00000006
+#define PCAPNG_BYTE_ORDER       0x1a2b3c4d
+#define PCAPNG_LINKTYPE_ETHER   1
+#define PCAPNG_OPT_END          0
+#define PCAPNG_OPT_COMMENT      1
+#define PCAPNG_OPT_IF_NAME      2
+#define PCAPNG_OPT_IF_TSRESOL   9
+
+#define PCAPNG_PAD4(len)    (((len) + 3) & ~3u)
+
+#define RT_CAP_COMMENT_LEN  48
+/* EPB: fixed part, data, comment, end of options, trailing length */
+#define RT_CAP_EPB_MAX      (28 + RT_CAP_MAX_SNAPLEN \
+    + 4 + RT_CAP_COMMENT_LEN + 4 + 4)
+
+/* In the private area of each capture mbuf */
+typedef struct {
+    uint64_t tsc;
+    uint32_t pktlen;    /* Length of the original packet */
+    uint16_t port;
+    uint16_t point;     /* RT_CAP_xxx */
+    uint16_t lcore;     /* UINT16_MAX: not an EAL lcore */
+    uint16_t reserved[3];
+} rt_cap_meta_t;
+
+const char *rt_cap_disc_names[RT_DISC_REASONS] = {
+    "qfull", "drop", "error", "term", "ignore", "arpq"
+};
+
+static struct rte_ring *rt_cap_ring = NULL;
+static struct rte_mempool *rt_cap_pool = NULL;
+static FILE *rt_cap_fd = NULL;
+
+static pthread_t rt_cap_writer;
+static volatile int rt_cap_writer_quit = 0;
+static uint64_t rt_cap_written = 0;
+static uint64_t rt_cap_bytes = 0;
+
+/* Wall clock time at rt_cap_tsc_base, for the timestamps */
+static uint64_t rt_cap_tsc_base;
+static uint64_t rt_cap_ns_base;
+
+static inline rt_cap_meta_t *
+rt_cap_meta (struct rte_mbuf *mbuf)
+{
+    /* The private area follows the mbuf header */
+    return (rt_cap_meta_t *) (mbuf + 1);
+}
+
+/*
+ * Queue a packet for the writer thread: 1 in --capture-sample of the
+ * packets that match. Called by any thread.
+ */
+void
+rt_cap_packet (struct rte_mbuf *mbuf, rt_port_index_t prtidx, uint32_t point)
+{
+    rt_lcore_stats_t *ls = rt_lcore_stats_self();
+    if ((ls->cap_matched++ % g.capture_sample) != 0)
+        return;
+
+    struct rte_mbuf *cap;
+    if (point & RT_CAP_DISC_ALL) {
+        cap = rte_pktmbuf_clone(mbuf, rt_cap_pool);
+    } else {
+        cap = rte_pktmbuf_alloc(rt_cap_pool);
+        if (likely(cap != NULL)) {
+            uint32_t len = RTE_MIN(rte_pktmbuf_data_len(mbuf),
+                g.capture_snaplen);
+            rte_memcpy(rte_pktmbuf_mtod(cap, void *),
+                rte_pktmbuf_mtod(mbuf, void *), len);
+            cap->data_len = len;
+            cap->pkt_len = len;
+        }
+    }
+    if (unlikely(cap == NULL)) {
+        ls->cap_dropped++;
+        return;
+    }
+
+    rt_cap_meta_t *cm = rt_cap_meta(cap);
+    unsigned lcore = rte_lcore_id();
+    cm->tsc = rte_rdtsc();
+    cm->pktlen = rte_pktmbuf_pkt_len(mbuf);
+    cm->port = prtidx;
+    cm->point = point;
+    cm->lcore = (lcore < RTE_MAX_LCORE) ? lcore : UINT16_MAX;
+
+    if (unlikely(rte_ring_mp_enqueue(rt_cap_ring, cap) != 0)) {
+        rte_pktmbuf_free(cap);
+        ls->cap_dropped++;
+        return;
+    }
+    ls->captured++;
+}
+
+/*
+ * Writer thread
+ */
+static void
+rt_cap_fwrite (const void *data, size_t len)
+{
+    if (fwrite(data, 1, len, rt_cap_fd) == len)
+        rt_cap_bytes += len;
+}
+
+static uint64_t
+rt_cap_tsc_to_ns (uint64_t tsc)
+{
+    uint64_t hz = rte_get_tsc_hz();
+    uint64_t d = tsc - rt_cap_tsc_base;
+    return rt_cap_ns_base + (d / hz) * NS_PER_S + (d % hz) * NS_PER_S / hz;
+}
+
+/* Append an option to the block in 'buf' at 'off', returns the new offset */
+static uint32_t
+rt_cap_opt (uint8_t *buf, uint32_t off, uint16_t code,
+    const void *data, uint16_t len)
+{
+    uint16_t hdr[2] = { code, len };
+    memcpy(&buf[off], hdr, sizeof(hdr));
+    memcpy(&buf[off + 4], data, len);
+    memset(&buf[off + 4 + len], 0, PCAPNG_PAD4(len) - len);
+    return off + 4 + PCAPNG_PAD4(len);
+}
+
+/* End the options and the block, and write it */
+static void
+rt_cap_block_write (uint8_t *buf, uint32_t off)
+{
+    uint32_t end = PCAPNG_OPT_END;
+    memcpy(&buf[off], &end, 4);
+    off += 4;
+    uint32_t len = off + 4;
+    memcpy(&buf[4], &len, 4);
+    memcpy(&buf[off], &len, 4);
+    rt_cap_fwrite(buf, len);
+}
+
+/* Section header, and one interface per port up to the last enabled */
+static void
+rt_cap_write_header (void)
+{
+    uint32_t shb[7] = { PCAPNG_SHB, sizeof(shb), PCAPNG_BYTE_ORDER, 0,
+        0xffffffff, 0xffffffff, sizeof(shb) };  /* Section length unknown */
+    uint16_t version[2] = { 1, 0 };
+    memcpy(&shb[3], version, sizeof(version));
+    rt_cap_fwrite(shb, sizeof(shb));
+
+    int prtidx, last = -1;
+    for (prtidx = 0 ; prtidx < RT_MAX_PORT_COUNT ; prtidx++) {
+        if (port_enabled(prtidx))
+            last = prtidx;
+    }
+    for (prtidx = 0 ; prtidx <= last ; prtidx++) {
+        uint8_t buf[64];
+        uint32_t fixed[4] = { PCAPNG_IDB, 0, 0, g.capture_snaplen };
+        uint16_t linktype[2] = { PCAPNG_LINKTYPE_ETHER, 0 };
+        memcpy(&fixed[2], linktype, sizeof(linktype));
+        memcpy(buf, fixed, sizeof(fixed));
+        char name[16];
+        int n = snprintf(name, sizeof(name), "port %d", prtidx);
+        uint32_t off = rt_cap_opt(buf, sizeof(fixed), PCAPNG_OPT_IF_NAME,
+            name, n);
+        uint8_t tsresol = 9;    /* Nanoseconds */
+        off = rt_cap_opt(buf, off, PCAPNG_OPT_IF_TSRESOL, &tsresol, 1);
+        rt_cap_block_write(buf, off);
+    }
+}
+
+/* Enhanced packet block, the capture point and lcore as comment */
+static void
+rt_cap_write_packet (struct rte_mbuf *cap)
+{
+    static uint8_t buf[RT_CAP_EPB_MAX];
+    const rt_cap_meta_t *cm = rt_cap_meta(cap);
+    uint32_t caplen = RTE_MIN(rte_pktmbuf_data_len(cap), g.capture_snaplen);
+    uint64_t ns = rt_cap_tsc_to_ns(cm->tsc);
+    uint32_t fixed[7] = { PCAPNG_EPB, 0, cm->port, (uint32_t) (ns >> 32),
+        (uint32_t) ns, caplen, cm->pktlen };
+    memcpy(buf, fixed, sizeof(fixed));
+    memcpy(&buf[28], rte_pktmbuf_mtod(cap, void *), caplen);
+    memset(&buf[28 + caplen], 0, PCAPNG_PAD4(caplen) - caplen);
+
+    char comment[RT_CAP_COMMENT_LEN];
+    const char *what = "discard";
+    const char *reason = "";
+    if (cm->point == RT_CAP_RX) {
+        what = "rx";
+    } else if (cm->point == RT_CAP_MISS) {
+        what = "dt-miss";
+    } else {
+        int idx;
+        for (idx = 0 ; idx < RT_DISC_REASONS ; idx++) {
+            if (cm->point == RT_CAP_DISC(idx))
+                reason = rt_cap_disc_names[idx];
+        }
+    }
+    int n = snprintf(comment, sizeof(comment), "%s%s%s lcore %d", what,
+        (reason[0] != '\0') ? " " : "", reason,
+        (cm->lcore != UINT16_MAX) ? (int) cm->lcore : -1);
+    n = RTE_MIN(n, RT_CAP_COMMENT_LEN - 1);
+    uint32_t off = rt_cap_opt(buf, 28 + PCAPNG_PAD4(caplen),
+        PCAPNG_OPT_COMMENT, comment, n);
+    rt_cap_block_write(buf, off);
+}
+
+/* Write what is in the ring, returns the number of packets */
+static unsigned
+rt_cap_drain (void)
+{
+    struct rte_mbuf *mbufs[RT_CAP_BURST];
+    unsigned cnt, idx, total = 0;
+    do {
+        cnt = rte_ring_sc_dequeue_burst(rt_cap_ring, (void **) mbufs,
+        #if RTE_VERSION >= RTE_VERSION_NUM(17,2,0,0)
+            RT_CAP_BURST, NULL);
+        #else
+            RT_CAP_BURST);
+        #endif
+        for (idx = 0 ; idx < cnt ; idx++) {
+            rt_cap_write_packet(mbufs[idx]);
+            rte_pktmbuf_free(mbufs[idx]);
+        }
+        total += cnt;
+    } while (cnt == RT_CAP_BURST);
+    if (total > 0) {
+        rt_cap_written += total;
+        fflush(rt_cap_fd);
+    }
+    return total;
+}
+
+static void *
+rt_cap_writer_main (__attribute__((unused)) void *arg)
+{
+    rt_stats_thread_slot(RT_STATS_CAP_SLOT);
+    while (!rt_cap_writer_quit) {
+        if (rt_cap_drain() == 0)
+            usleep(RT_CAP_DRAIN_US);
+    }
+    rt_cap_drain();
+    return NULL;
+}
+
+void
+rt_cap_init (void)
+{
+    if (g.capture_fname == NULL) {
+        g.capture_points = 0;
+        return;
+    }
+    if (g.capture_points == 0)
+        g.capture_points = RT_CAP_RX;
+
+    rt_cap_fd = fopen(g.capture_fname, "w");
+    if (rt_cap_fd == NULL)
+        rte_exit(EXIT_FAILURE, "Cannot open capture file %s\n",
+            g.capture_fname);
+    rt_cap_ring = rte_ring_create("capture_ring", RT_CAP_RING_SIZE,
+        SOCKET_ID_ANY, RING_F_SC_DEQ);
+    if (rt_cap_ring == NULL)
+        rte_exit(EXIT_FAILURE, "Cannot create capture ring\n");
+    rt_cap_pool = rte_pktmbuf_pool_create("capture_pool", RT_CAP_POOL_SIZE,
+        RT_CAP_POOL_CACHE, sizeof(rt_cap_meta_t),
+        RTE_PKTMBUF_HEADROOM + g.capture_snaplen, SOCKET_ID_ANY);
+    if (rt_cap_pool == NULL)
+        rte_exit(EXIT_FAILURE, "Cannot init capture mbuf pool\n");
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    rt_cap_tsc_base = rte_rdtsc();
+    rt_cap_ns_base = (uint64_t) ts.tv_sec * NS_PER_S + ts.tv_nsec;
+
+    rt_cap_write_header();
+    fflush(rt_cap_fd);
+    if (pthread_create(&rt_cap_writer, NULL, rt_cap_writer_main, NULL) != 0)
+        rte_exit(EXIT_FAILURE, "Cannot create capture writer thread\n");
+    dbgmsg(CONF, nopkt, "Capturing to %s, points 0x%x, ports 0x%" PRIx64
+        ", 1 in %u, %u bytes", g.capture_fname, g.capture_points,
+        g.capture_ports, g.capture_sample, g.capture_snaplen);
+}
+
+/* Write out what is left in the ring, called once the lcores stopped */
+void
+rt_cap_close (void)
+{
+    if (rt_cap_fd == NULL)
+        return;
+    g.capture_points = 0;
+    rt_cap_writer_quit = 1;
+    pthread_join(rt_cap_writer, NULL);
+    fclose(rt_cap_fd);
+    rt_cap_fd = NULL;
+}
+
+void
+rt_cap_print_stats (FILE *fd)
+{
+    uint64_t matched = 0, captured = 0, dropped = 0;
+    unsigned slot;
+    if (rt_cap_fd == NULL)
+        return;
+    for (slot = 0 ; slot < RT_STATS_SLOTS ; slot++) {
+        matched += rt_lcore_stats[slot].cap_matched;
+        captured += rt_lcore_stats[slot].captured;
+        dropped += rt_lcore_stats[slot].cap_dropped;
+    }
+    fprintf(fd, "Capture: %" PRIu64 " matched, %" PRIu64 " captured, %"
+        PRIu64 " dropped, %" PRIu64 " written (%" PRIu64 " bytes),"
+        " %u waiting\n", matched, captured, dropped, rt_cap_written,
+        rt_cap_bytes, rte_ring_count(rt_cap_ring));
+    fflush(fd);
+}
@@ -0,0 +1,74 @@
+#ifndef __RT_CAPTURE_H__
+#define __RT_CAPTURE_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <rte_branch_prediction.h>
+#include <rte_mbuf.h>
+
+#include "defines.h"
+#include "stats.h"
+
+/*
+ * Packet capture (--capture-file)
+ *
+ * Packets selected by capture point, receive port and sampling are
+ * queued on one multi-producer ring, and a background thread writes
+ * them to a pcapng file (one interface per port, nanosecond
+ * timestamps derived from the TSC, the capture point as the packet
+ * comment). Lcores do not wait for the file: a packet that finds no
+ * mbuf or no room in the ring is not captured, and counted.
+ *
+ * Received packets and DT misses go on being processed, and are
+ * rewritten in place, so the first snaplen bytes are copied into a
+ * mbuf of the capture pool. Discarded packets are not changed any
+ * more; they are cloned, and the writer thread releases the data.
+ */
+
+#define RT_CAP_RING_SIZE    4096
+#define RT_CAP_BURST        64
+#define RT_CAP_DRAIN_US     1000    /* Writer thread poll interval */
+
+/* Capture points (g.capture_points); discards use the bit of the reason */
+#define RT_CAP_DISC(reason) (1u << (reason))
+#define RT_CAP_DISC_ALL     (RT_CAP_DISC(RT_DISC_REASONS) - 1)
+#define RT_CAP_RX           (1u << 8)   /* Everything received */
+#define RT_CAP_MISS         (1u << 9)   /* IPv4 Direct Table misses */
+
+extern const char *rt_cap_disc_names[RT_DISC_REASONS];
+
+/* Is 'point' captured for packets received on 'prtidx'? */
+static inline int
+rt_cap_wanted (uint32_t point, rt_port_index_t prtidx)
+{
+    return unlikely(g.capture_points & point)
+        && ((g.capture_ports & (1LU << prtidx)) != 0);
+}
+
+void rt_cap_packet (struct rte_mbuf *mbuf, rt_port_index_t prtidx,
+    uint32_t point);
+
+/*
+ * Packets dropped on a full TX queue or ring (RT_DISC_QFULL), before
+ * they are freed. These are selected by the port they came in on.
+ */
+static inline void
+rt_cap_qfull (struct rte_mbuf **mbufs, unsigned count)
+{
+    unsigned idx;
+    if (likely(!(g.capture_points & RT_CAP_DISC(RT_DISC_QFULL))))
+        return;
+    for (idx = 0 ; idx < count ; idx++) {
+        rt_port_index_t prtidx = mbufs[idx]->port;
+        if ((prtidx < RT_MAX_PORT_COUNT)
+                && rt_cap_wanted(RT_CAP_DISC(RT_DISC_QFULL), prtidx))
+            rt_cap_packet(mbufs[idx], prtidx, RT_CAP_DISC(RT_DISC_QFULL));
+    }
+}
+
+void rt_cap_init (void);
+void rt_cap_close (void);
+void rt_cap_print_stats (FILE *fd);
+
+#endif
@@ -0,0 +1,78 @@
+#include <arpa/inet.h>
+
+#include <rte_cpuflags.h>
+#include <rte_hash_crc.h>
+#include <rte_vect.h>
+
+#include "classify.h"
+#include "pktdefs.h"
+#include "dbgmsg.h"
+
+rt_classify_fn_t rt_classify_burst;
+
+static void
+rt_classify_scalar (struct rte_mbuf **mbufs, int count,
+    rt_port_index_t port, rt_pkt_class_t *pc)
+{
+    int idx;
+    for (idx = 0 ; idx < count ; idx++) {
+        const rt_eth_hdr_t *eth = rte_pktmbuf_mtod(mbufs[idx], void *);
+        rt_dt_key_t *key = &pc->key[idx];
+        pc->ethtype[idx] = ntohs(eth->ethtype);
+        key->prtidx = port;
+        key->ipaddr = ntohl(*PTR(eth, uint32_t, 14 + 16));
+        memcpy(key->hwaddr, eth->dst, 6);
+        pc->hash[idx] = rt_dt_hash(key);
+    }
+}
+
+#ifdef RTE_ARCH_X86
+
+/*
+ * Build each key with two unaligned 16-byte loads and two byte
+ * shuffles: bytes 0..15 of the frame hold the destination MAC and
+ * the ETHTYPE, bytes 18..33 end with the IPv4 destination address
+ * (byte-swapped into host order by the shuffle). The CRC32-C of the
+ * key is taken straight from the vector register.
+ */
+__attribute__((target("sse4.2")))
+static void
+rt_classify_sse (struct rte_mbuf **mbufs, int count,
+    rt_port_index_t port, rt_pkt_class_t *pc)
+{
+    const __m128i mask_mac = _mm_setr_epi8(
+        -1, -1, -1, -1, -1, -1, 0, 1, 2, 3, 4, 5, -1, -1, -1, -1);
+    const __m128i mask_ip = _mm_setr_epi8(
+        15, 14, 13, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i portv = _mm_setr_epi16(0, 0, port, 0, 0, 0, 0, 0);
+    int idx;
+
+    for (idx = 0 ; idx < count ; idx++) {
+        const uint8_t *eth = rte_pktmbuf_mtod(mbufs[idx], const uint8_t *);
+        __m128i a = _mm_loadu_si128((const __m128i *) eth);
+        __m128i b = _mm_loadu_si128((const __m128i *) &eth[18]);
+        __m128i k = _mm_or_si128(portv,
+            _mm_or_si128(_mm_shuffle_epi8(a, mask_mac),
+                _mm_shuffle_epi8(b, mask_ip)));
+        _mm_storeu_si128((__m128i *) &pc->key[idx], k);
+        pc->ethtype[idx] = ntohs(_mm_extract_epi16(a, 6));
+        uint32_t crc = _mm_crc32_u64(0xffffffff, _mm_cvtsi128_si64(k));
+        pc->hash[idx] = _mm_crc32_u32(crc, _mm_extract_epi32(k, 2));
+    }
+}
+
+#endif
+
+void
+rt_classify_init (void)
+{
+    const char *name = "scalar";
+    rt_classify_burst = rt_classify_scalar;
+#ifdef RTE_ARCH_X86
+    if (rte_cpu_get_flag_enabled(RTE_CPUFLAG_SSE4_2) > 0) {
+        rt_classify_burst = rt_classify_sse;
+        name = "SSE4.2";
+    }
+#endif
+    dbgmsg(CONF, nopkt, "Header classification: %s", name);
+}
@@ -0,0 +1,31 @@
+#ifndef __RT_CLASSIFY_H__
+#define __RT_CLASSIFY_H__
+
+#include <stdint.h>
+
+#include <rte_mbuf.h>
+
+#include "defines.h"
+#include "tables.h"
+
+/*
+ * Header classification of a received burst in structure-of-arrays
+ * form: ETHTYPE, Direct-Table key (IPv4 DA, port, destination MAC)
+ * and key hash for every packet.
+ */
+typedef struct {
+    uint16_t ethtype[MAX_PKT_BURST];
+    uint32_t hash[MAX_PKT_BURST];
+    /* One spare key: the vector path stores 16 bytes per 12-byte key */
+    rt_dt_key_t key[MAX_PKT_BURST + 1];
+} rt_pkt_class_t;
+
+typedef void (*rt_classify_fn_t) (struct rte_mbuf **mbufs, int count,
+    rt_port_index_t port, rt_pkt_class_t *pc);
+
+/* Selected at startup by rt_classify_init() */
+extern rt_classify_fn_t rt_classify_burst;
+
+void rt_classify_init (void);
+
+#endif
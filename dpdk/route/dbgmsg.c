@@ -1,12 +1,22 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include <rte_cycles.h>
+#include <rte_lcore.h>
+#include <rte_malloc.h>
+#include <rte_spinlock.h>
 
 #include "defines.h"
 #include "dbgmsg.h"
 #include "pktutils.h"
+#include "numa.h"
+#include "stats.h"
 
 FILE *rt_log_fd = NULL;
 rt_pkt_t nopkt;
@@ -15,6 +25,36 @@ dbgmsg_globals_t dbgmsg_globals;
 
 static float dbg_speed_factor = 0;
 
+typedef struct {
+    void *mbuf;
+    uint16_t port;
+    uint16_t pktlen;
+    uint8_t level;
+    uint8_t has_port;
+    char msg[DBGMSG_MSG_LEN];
+    uint8_t pkt[DBGMSG_PKT_LEN];
+} dbgmsg_rec_t;
+
+typedef struct {
+    /* Producer side */
+    uint32_t head __rte_cache_aligned;
+    uint64_t dropped;
+    rte_spinlock_t lock;        /* Shared ring only */
+    /* Consumer side (writer thread) */
+    uint32_t tail __rte_cache_aligned;
+    uint64_t dropped_seen;
+    dbgmsg_rec_t rec[DBGMSG_RING_SIZE] __rte_cache_aligned;
+} dbgmsg_ring_t;
+
+#define DBGMSG_SLOTS (RTE_MAX_LCORE + 1)
+
+static dbgmsg_ring_t *dbgmsg_rings[DBGMSG_SLOTS];
+static pthread_t dbgmsg_writer;
+static int dbgmsg_writer_running = 0;
+static volatile int dbgmsg_writer_quit = 0;
+static uint64_t dbgmsg_written = 0;
+static uint64_t dbgmsg_fsize = 0;       /* Bytes in the current log file */
+
 static inline int64_t
 dbg_calc_new_credits (dbgmsg_state_t *dbgstate)
 {
@@ -67,21 +107,147 @@ dbg_check_credits (dbgmsg_state_t *dbgstate)
     return 1;
 }
 
+/* Copy the record into the ring of the calling thread */
+static inline void
+dbgmsg_push (int level, rt_pkt_t pkt, const char *fmt, va_list ap)
+{
+    unsigned slot = rte_lcore_id();
+    if (slot >= RTE_MAX_LCORE)
+        slot = RTE_MAX_LCORE;
+    dbgmsg_ring_t *r = dbgmsg_rings[slot];
+    if (unlikely(r == NULL))
+        return;
+    if (slot == RTE_MAX_LCORE)
+        rte_spinlock_lock(&r->lock);
+
+    uint32_t head = r->head;
+    if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE)
+            >= DBGMSG_RING_SIZE) {
+        __atomic_store_n(&r->dropped, r->dropped + 1, __ATOMIC_RELAXED);
+        goto Unlock;
+    }
+    dbgmsg_rec_t *rec = &r->rec[head & (DBGMSG_RING_SIZE - 1)];
+    rec->level = level;
+    rec->has_port = (pkt.pi != NULL);
+    rec->port = (pkt.pi != NULL) ? pkt.pi->idx : 0;
+    vsnprintf(rec->msg, DBGMSG_MSG_LEN, fmt, ap);
+    rec->mbuf = pkt.mbuf;
+    rec->pktlen = 0;
+    if ((pkt.mbuf != NULL) && (dbgmsg_globals.log_packets)) {
+        int len = min(dbgmsg_globals.log_pkt_len, rt_pkt_length(pkt));
+        len = min(len, DBGMSG_PKT_LEN);
+        memcpy(rec->pkt, pkt.eth, len);
+        rec->pktlen = len;
+    }
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+
+  Unlock:
+    if (slot == RTE_MAX_LCORE)
+        rte_spinlock_unlock(&r->lock);
+}
+
 void f_dbgmsg (dbgmsg_state_t *dbgstate,
     int level, rt_pkt_t pkt, const char *fmt, ...)
 {
-    const int max_pkt_size_log_len = 2048;
-    char str[256 + 3 * max_pkt_size_log_len];
-    int n = 0;
-
     if (rt_log_fd == NULL)
         return;
 
     if (dbg_check_credits(dbgstate) == 0)
         return;
 
+    va_list ap;
+    va_start(ap, fmt);
+    dbgmsg_push(level, pkt, fmt, ap);
+    va_end(ap);
+}
+
+/*
+ * Log file, written by the writer thread only (and before it starts)
+ */
+static void
+dbgmsg_fwrite (const void *data, size_t len)
+{
+    if (fwrite(data, 1, len, rt_log_fd) == len)
+        dbgmsg_fsize += len;
+}
+
+/* Name of log file 'idx': <name>, <name>.1, <name>.2 ... */
+static void
+dbgmsg_segment_name (char *str, size_t size, int idx)
+{
+    if (idx == 0)
+        snprintf(str, size, "%s", dbgmsg_globals.log_fname);
+    else
+        snprintf(str, size, "%s.%d", dbgmsg_globals.log_fname, idx);
+}
+
+/* Open the log file, appending; binary files start with the header */
+static int
+dbgmsg_fstart (const char *mode)
+{
+    rt_log_fd = fopen(dbgmsg_globals.log_fname, mode);
+    if (rt_log_fd == NULL)
+        return -1;
+    fseek(rt_log_fd, 0, SEEK_END);
+    long pos = ftell(rt_log_fd);
+    dbgmsg_fsize = (pos > 0) ? pos : 0;
+    if (dbgmsg_globals.log_binary && (dbgmsg_fsize == 0)) {
+        uint16_t version = DBGMSG_BIN_VERSION;
+        dbgmsg_fwrite(DBGMSG_BIN_MAGIC, 6);
+        dbgmsg_fwrite(&version, sizeof(version));
+    }
+    return 0;
+}
+
+/* Start a new log file once the current one is full (--log-max-size) */
+static void
+dbgmsg_rotate (void)
+{
+    char from[PATH_MAX], to[PATH_MAX];
+    int idx;
+    fclose(rt_log_fd);
+    for (idx = dbgmsg_globals.log_segments - 1 ; idx > 0 ; idx--) {
+        dbgmsg_segment_name(from, sizeof(from), idx - 1);
+        dbgmsg_segment_name(to, sizeof(to), idx);
+        /* Fails for segments not written yet */
+        rename(from, to);
+    }
+    if (dbgmsg_fstart("w") < 0)
+        fprintf(stderr, "ERROR: cannot start new log file, logging stops\n");
+}
+
+static void
+dbgmsg_write_bin (const dbgmsg_rec_t *rec)
+{
+    dbgmsg_bin_hdr_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.type = DBGMSG_BIN_T_MSG;
+    hdr.level = rec->level;
+    hdr.flags = DBGMSG_BIN_F_PORTCOL;
+    if (rec->has_port) {
+        hdr.flags |= DBGMSG_BIN_F_PORT;
+        hdr.port = rec->port;
+    }
+    hdr.msglen = strnlen(rec->msg, DBGMSG_MSG_LEN);
+    if ((rec->mbuf != NULL) && dbgmsg_globals.log_packets) {
+        hdr.mbuf = (uintptr_t) rec->mbuf;
+        hdr.pktlen = rec->pktlen;
+    }
+    hdr.size = sizeof(hdr) + hdr.msglen + hdr.pktlen;
+    dbgmsg_fwrite(&hdr, sizeof(hdr));
+    dbgmsg_fwrite(rec->msg, hdr.msglen);
+    dbgmsg_fwrite(rec->pkt, hdr.pktlen);
+}
+
+static void
+dbgmsg_write_text (const dbgmsg_rec_t *rec)
+{
+    static const char hex[] = "0123456789abcdef";
+    char str[64 + DBGMSG_MSG_LEN + 3 * DBGMSG_PKT_LEN];
+    int n = 0;
+
     const char *lvlstr;
-    switch (level) {
+    switch (rec->level) {
         case DEBUG:  lvlstr = "D"; break;
         case INFO:   lvlstr = "I"; break;
         case WARN:   lvlstr = "W"; break;
@@ -91,32 +257,118 @@ void f_dbgmsg (dbgmsg_state_t *dbgstate,
     }
     n += sprintf(&str[n], "%s ", lvlstr);
 
-    if (pkt.pi != NULL)
-        n += sprintf(&str[n], "%3u  ", pkt.pi->idx);
+    if (rec->has_port)
+        n += sprintf(&str[n], "%3u  ", rec->port);
     else
         n += sprintf(&str[n], "     ");
 
-    va_list ap;
-    va_start(ap, fmt);
-    int rc = vsnprintf(&str[n], 2048, fmt, ap);
-    va_end(ap);
-    n += min(2048, rc);
-
-    n += sprintf(&str[n], "\n");
+    n += sprintf(&str[n], "%s\n", rec->msg);
 
-    if ((pkt.mbuf != NULL) && (dbgmsg_globals.log_packets)) {
-        n += sprintf(&str[n], "-  %18p  ", pkt.mbuf);
+    if (rec->mbuf != NULL && dbgmsg_globals.log_packets) {
+        n += sprintf(&str[n], "-  %18p  ", rec->mbuf);
         int i;
-        uint8_t *ba = (uint8_t *) pkt.eth;
-        int len = min(dbgmsg_globals.log_pkt_len, rt_pkt_length(pkt));
-        len = min(len, max_pkt_size_log_len);
-        for (i = 0 ; i < len ; i++)
-            n += sprintf(&str[n], " %02x", ba[i]);
-        n += sprintf(&str[n], "\n");
+        for (i = 0 ; i < rec->pktlen ; i++) {
+            str[n++] = ' ';
+            str[n++] = hex[rec->pkt[i] >> 4];
+            str[n++] = hex[rec->pkt[i] & 0xf];
+        }
+        str[n++] = '\n';
     }
 
-    fprintf(rt_log_fd, "%s", str);
-    fflush(rt_log_fd);
+    dbgmsg_fwrite(str, n);
+}
+
+static void
+dbgmsg_write (const dbgmsg_rec_t *rec)
+{
+    if (rt_log_fd == NULL)
+        return;
+    if (dbgmsg_globals.log_binary)
+        dbgmsg_write_bin(rec);
+    else
+        dbgmsg_write_text(rec);
+    if ((dbgmsg_globals.log_max_size > 0)
+            && (dbgmsg_fsize >= dbgmsg_globals.log_max_size))
+        dbgmsg_rotate();
+}
+
+/* Write what is in the rings, returns the number of records */
+static int
+dbgmsg_drain (void)
+{
+    int total = 0;
+    unsigned slot;
+    for (slot = 0 ; slot < DBGMSG_SLOTS ; slot++) {
+        dbgmsg_ring_t *r = dbgmsg_rings[slot];
+        if (r == NULL)
+            continue;
+        uint64_t dropped = __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+        if (dropped != r->dropped_seen) {
+            dbgmsg_rec_t note;
+            memset(&note, 0, sizeof(note));
+            note.level = WARN;
+            snprintf(note.msg, DBGMSG_MSG_LEN, "%" PRIu64 " log messages"
+                " dropped (lcore %d)", dropped - r->dropped_seen,
+                (slot < RTE_MAX_LCORE) ? (int) slot : -1);
+            dbgmsg_write(&note);
+            r->dropped_seen = dropped;
+        }
+        uint32_t tail = r->tail;
+        uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        while (tail != head) {
+            dbgmsg_write(&r->rec[tail & (DBGMSG_RING_SIZE - 1)]);
+            tail++;
+            total++;
+        }
+        __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+    }
+    if ((total > 0) && (rt_log_fd != NULL)) {
+        dbgmsg_written += total;
+        fflush(rt_log_fd);
+    }
+    return total;
+}
+
+static void *
+dbgmsg_writer_main (__attribute__((unused)) void *arg)
+{
+    rt_stats_thread_slot(RT_STATS_LOG_SLOT);
+    while (!dbgmsg_writer_quit) {
+        if (dbgmsg_drain() == 0)
+            usleep(DBGMSG_DRAIN_US);
+    }
+    dbgmsg_drain();
+    return NULL;
+}
+
+/* One ring per enabled lcore, and the shared one */
+static void
+dbgmsg_rings_init (void)
+{
+    unsigned slot;
+    for (slot = 0 ; slot < DBGMSG_SLOTS ; slot++) {
+        if (dbgmsg_rings[slot] != NULL)
+            continue;
+        if ((slot < RTE_MAX_LCORE) && !rte_lcore_is_enabled(slot))
+            continue;
+        int socket = (slot < RTE_MAX_LCORE)
+            ? rt_numa_lcore_socket(slot) : SOCKET_ID_ANY;
+        dbgmsg_ring_t *r = (dbgmsg_ring_t *) rte_zmalloc_socket(
+            "dbgmsg_ring", sizeof(dbgmsg_ring_t), RTE_CACHE_LINE_SIZE, socket);
+        assert(r != NULL);
+        rte_spinlock_init(&r->lock);
+        dbgmsg_rings[slot] = r;
+    }
+}
+
+static void
+dbgmsg_writer_stop (void)
+{
+    if (!dbgmsg_writer_running)
+        return;
+    dbgmsg_writer_quit = 1;
+    pthread_join(dbgmsg_writer, NULL);
+    dbgmsg_writer_running = 0;
 }
 
 void dbgmsg_hexdump (void *data, int len)
@@ -135,24 +387,62 @@ void dbgmsg_init (void)
     dbgmsg_globals.log_level = INFO;
     dbgmsg_globals.log_packets = 0;
     dbgmsg_globals.log_pkt_len = 14 + 20 + 8;
+    dbgmsg_globals.log_segments = DBGMSG_DEFAULT_SEGMENTS;
 }
 
 int dbgmsg_fopen (const char *fname)
 {
+    dbgmsg_writer_stop();
     if (rt_log_fd != NULL)
         fclose(rt_log_fd);
-    rt_log_fd = fopen(fname, "a");
-    if (rt_log_fd == NULL) {
+    dbgmsg_globals.log_fname = fname;
+    if (dbgmsg_fstart("a") < 0) {
         fprintf(stderr, "ERROR: faild to open %s\n", fname);
         return -1;
     }
-    fprintf(rt_log_fd, "\n\n----------\n");
+    if (dbgmsg_globals.log_binary) {
+        dbgmsg_bin_hdr_t hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.size = sizeof(hdr);
+        hdr.type = DBGMSG_BIN_T_SESSION;
+        dbgmsg_fwrite(&hdr, sizeof(hdr));
+    } else {
+        dbgmsg_fwrite("\n\n----------\n", 13);
+    }
     fflush(rt_log_fd);
+    dbgmsg_rings_init();
+    dbgmsg_writer_quit = 0;
+    if (pthread_create(&dbgmsg_writer, NULL, dbgmsg_writer_main, NULL) != 0) {
+        fprintf(stderr, "ERROR: cannot create log writer thread\n");
+        fclose(rt_log_fd);
+        rt_log_fd = NULL;
+        return -1;
+    }
+    dbgmsg_writer_running = 1;
     return 0;
 }
 
 void dbgmsg_close (void)
 {
+    if (rt_log_fd == NULL)
+        return;
+    dbgmsg_writer_stop();
     fflush(rt_log_fd);
     fclose(rt_log_fd);
+    rt_log_fd = NULL;
+}
+
+void dbgmsg_print_stats (FILE *fd)
+{
+    uint64_t dropped = 0;
+    unsigned slot;
+    if (rt_log_fd == NULL)
+        return;
+    for (slot = 0 ; slot < DBGMSG_SLOTS ; slot++) {
+        if (dbgmsg_rings[slot] != NULL)
+            dropped += dbgmsg_rings[slot]->dropped;
+    }
+    fprintf(fd, "Log: %" PRIu64 " messages written, %" PRIu64 " dropped\n",
+        dbgmsg_written, dropped);
+    fflush(fd);
 }
@@ -3,6 +3,7 @@
 
 #include <arpa/inet.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #include <rte_atomic.h>
 
@@ -13,10 +14,62 @@ typedef struct {
     int log_level;
     int log_packets;
     int log_pkt_len;
+    const char *log_fname;  /* Opened once the options are parsed */
+    int log_binary;         /* Binary records (see decode-log.py) */
+    uint64_t log_max_size;  /* Bytes per log file, 0: no limit */
+    int log_segments;       /* Log files kept, the current one included */
 } dbgmsg_globals_t;
 
 extern dbgmsg_globals_t dbgmsg_globals;
 
+/*
+ * Log records are not written by the lcore that logs them. f_dbgmsg()
+ * formats the message text and copies the packet bytes into a record
+ * of the lcore's ring (one producer, one consumer, no locks), and a
+ * background thread adds the prefix and hex dump and writes the log
+ * file. A full ring drops the record; the thread logs how many were
+ * dropped. Threads that are not EAL lcores share one extra ring,
+ * under a lock.
+ */
+#define DBGMSG_RING_SIZE    1024    /* Records per lcore, power of 2 */
+#define DBGMSG_MSG_LEN      256
+#define DBGMSG_PKT_LEN      240     /* Bytes kept of --log-packets */
+#define DBGMSG_DRAIN_US     1000    /* Writer thread poll interval */
+
+/*
+ * Log rotation (--log-max-size): once the log file reaches the size,
+ * it is renamed to <name>.1, <name>.1 to <name>.2 and so on, keeping
+ * --log-segments files in all, and a new file is started.
+ */
+#define DBGMSG_DEFAULT_SEGMENTS 4
+
+/*
+ * Binary log format (--log-binary), host byte order. A file starts
+ * with DBGMSG_BIN_MAGIC and the version; each record is a header
+ * followed by the message text and the packet bytes. decode-log.py
+ * turns it back into the text format.
+ */
+#define DBGMSG_BIN_MAGIC        "RTLOG\0"
+#define DBGMSG_BIN_VERSION      1
+
+#define DBGMSG_BIN_T_MSG        1
+#define DBGMSG_BIN_T_SESSION    2   /* Log opened ("----------") */
+
+#define DBGMSG_BIN_F_PORT       (1 << 0)    /* 'port' is valid */
+#define DBGMSG_BIN_F_PORTCOL    (1 << 1)    /* Text has a port column */
+
+typedef struct __attribute__ ((__packed__)) {
+    uint16_t size;      /* Record size, this header included */
+    uint8_t type;       /* DBGMSG_BIN_T_xxx */
+    uint8_t level;
+    uint8_t flags;      /* DBGMSG_BIN_F_xxx */
+    uint8_t reserved;
+    uint16_t port;
+    uint16_t msglen;
+    uint16_t pktlen;
+    uint64_t mbuf;      /* Shown in the packet dump line */
+} dbgmsg_bin_hdr_t;
+
 typedef struct {
     int64_t maxcredits;
     int64_t speed;
@@ -100,6 +153,7 @@ void dbgmsg_hexdump (void *data, int len);
 extern void dbgmsg_init (void);
 extern int dbgmsg_fopen (const char *fname);
 extern void dbgmsg_close (void);
+extern void dbgmsg_print_stats (FILE *fd);
 
 #define ERROR   1
 #define CONF    2
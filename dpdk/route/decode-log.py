@@ -0,0 +1,82 @@
+#!/usr/bin/env python
+
+# Turn binary log files (--log-binary) back into the text log format.
+# Several files are decoded in the order given, e.g. after rotation
+# (--log-max-size) the oldest first:
+#
+#   decode-log.py route.log.3 route.log.2 route.log.1 route.log
+
+import sys
+import struct
+
+MAGIC = b'RTLOG\0'
+VERSION = 1
+
+T_MSG = 1
+T_SESSION = 2
+
+F_PORT = 0x01
+F_PORTCOL = 0x02
+
+# See dbgmsg_bin_hdr_t in dbgmsg.h
+HDR = struct.Struct('<HBBBBHHHQ')
+
+LEVELS = { 1: 'E', 2: 'C', 3: 'W', 4: 'I', 5: 'D' }
+
+def decode_record(hdr, data, out):
+    size, rtype, level, flags, _, port, msglen, pktlen, mbuf = hdr
+    if (rtype == T_SESSION):
+        out.write('\n\n----------\n')
+        return
+    if (rtype != T_MSG):
+        return
+    line = LEVELS.get(level, '?') + ' '
+    if (flags & F_PORT):
+        line = line + '{p:3}  '.format(p = port)
+    elif (flags & F_PORTCOL):
+        line = line + '     '
+    msg = data[:msglen].decode('ascii', 'replace')
+    out.write(line + msg + '\n')
+    if (mbuf != 0) or (pktlen > 0):
+        pkt = bytearray(data[msglen:msglen + pktlen])
+        out.write('-  {m:>18}  '.format(m = '0x%x' % mbuf)
+            + ''.join([' %02x' % b for b in pkt]) + '\n')
+
+def decode_file(fname, out):
+    with open(fname, 'rb') as fp:
+        head = fp.read(len(MAGIC) + 2)
+        if (len(head) < len(MAGIC) + 2) or (head[:len(MAGIC)] != MAGIC):
+            sys.stderr.write('ERROR: ' + fname + ' is not a binary log\n')
+            return -1
+        version = struct.unpack('<H', head[len(MAGIC):])[0]
+        if (version != VERSION):
+            sys.stderr.write('ERROR: ' + fname + ': unsupported version '
+                + str(version) + '\n')
+            return -1
+        while True:
+            raw = fp.read(HDR.size)
+            if (len(raw) == 0):
+                break
+            if (len(raw) < HDR.size):
+                sys.stderr.write('WARNING: ' + fname + ': truncated record\n')
+                break
+            hdr = HDR.unpack(raw)
+            if (hdr[0] < HDR.size):
+                sys.stderr.write('ERROR: ' + fname + ': bad record size\n')
+                return -1
+            data = fp.read(hdr[0] - HDR.size)
+            if (len(data) < hdr[0] - HDR.size):
+                sys.stderr.write('WARNING: ' + fname + ': truncated record\n')
+                break
+            decode_record(hdr, data, out)
+    return 0
+
+if (len(sys.argv) < 2):
+    print('Usage: ' + sys.argv[0] + ' <log file>...')
+    exit(-1)
+
+rc = 0
+for fname in sys.argv[1:]:
+    if (decode_file(fname, sys.stdout) < 0):
+        rc = -1
+exit(rc)
@@ -18,6 +18,38 @@
 #define RTE_TX_DESC_DEFAULT 2048
 
 #define RTE_MBUF_DESC_MARGIN 16384
+#define MEMPOOL_CACHE_SIZE 256
+
+/* Default number of Direct Table entries */
+#define RT_AR_DEFAULT_QUEUE_DEPTH 16
+#define RT_AR_MAX_QUEUE_DEPTH   1024
+#define RT_AR_DEFAULT_REACHABLE 30
+#define RT_AR_DEFAULT_STALE     60
+#define RT_DT_DEFAULT_SIZE (1 << 17)
+#define RT_DT_DEFAULT_IDLE      300
+
+/* TX drain policy (when to flush partial TX batches) */
+#define RT_TX_DRAIN_LOOP        0   /* Every main loop iteration */
+#define RT_TX_DRAIN_LATENCY     1   /* Once the oldest packet waited */
+#define RT_TX_DRAIN_IDLE        2   /* Same, or when RX is idle */
+#define RT_TX_DRAIN_DEFAULT_US  100
+#define RT_TX_HOLD_DEFAULT_US   200
+
+/* Idle time before waiting for RX interrupts (--power-intr-ms) */
+#define RT_PWR_INTR_DEFAULT_MS  100
+
+/* Packets per second a forwarding lcore may punt (--punt-rate) */
+#define RT_PUNT_DEFAULT_RATE    20000
+
+/* Bytes kept of each captured packet (--capture-snaplen) */
+#define RT_CAP_DEFAULT_SNAPLEN  128
+#define RT_CAP_MAX_SNAPLEN      2048
+
+/* RSS hash fields (--rss-hash) */
+#define RT_RSS_IP               0   /* IP addresses only */
+#define RT_RSS_L4               1   /* TCP/UDP flows only */
+#define RT_RSS_IP_L4            2   /* TCP/UDP flows, IP for others */
+#define RT_RSS_KEY_MAX          52
 
 /* Network Byte Order Ethernet Hardware (MAC) Address */
 typedef uint8_t rt_eth_addr_t[6];
@@ -47,6 +79,36 @@ typedef struct {
     uint64_t enabled_port_mask;
     int rx_queue_per_lcore;
     uint64_t rand_disc_level;
+    /* Direct Table size (entries) */
+    uint32_t dt_size;
+    uint32_t dt_budget;     /* entries, 0: 3/4 of the table */
+    uint32_t dt_idle;       /* seconds, 0: no idle timeout */
+    int dt_histogram;
+    int top_counters;
+    int ar_queue_depth;
+    uint32_t ar_reachable;  /* seconds */
+    uint32_t ar_stale;      /* seconds */
+    int direct_tx;
+    int bulk_free;          /* Discards are freed in bulk */
+    int rss_hash;           /* RT_RSS_xxx */
+    uint8_t rss_key[RT_RSS_KEY_MAX];
+    uint8_t rss_key_len;    /* 0: driver default key */
+    int tx_drain;           /* RT_TX_DRAIN_xxx */
+    uint32_t tx_drain_us;   /* Latency budget */
+    uint64_t tx_drain_tsc;  /* Same, in TSC cycles */
+    uint32_t tx_hold_us;    /* Max hold time of unsent packets */
+    uint64_t tx_hold_tsc;   /* Same, in TSC cycles */
+    uint32_t rx_balance_ms; /* RX queue rebalancing interval, 0: off */
+    uint64_t rx_balance_tsc;
+    int power;              /* Back off when idle (--power) */
+    uint32_t power_intr_ms; /* Idle time before RX interrupts, 0: never */
+    int ctrl_lcore;         /* Slow path lcore, -1: inline (--ctrl-lcore) */
+    uint32_t punt_rate;     /* Packets/s per lcore, 0: no limit */
+    const char *capture_fname;  /* pcapng file (--capture-file) */
+    uint32_t capture_points;    /* RT_CAP_xxx, 0: no capture */
+    uint64_t capture_ports;     /* Mask of ports captured on */
+    uint32_t capture_sample;    /* Capture 1 in n of the packets */
+    uint32_t capture_snaplen;
 } rt_global_t;
 
 extern rt_global_t g;
@@ -64,9 +126,26 @@ rt_global_init (void)
     g.print_statistics = 1;
     g.timer_period = 2; /* default period is 10 seconds */
     g.rx_queue_per_lcore = 1;
+    g.dt_size = RT_DT_DEFAULT_SIZE;
+    g.dt_idle = RT_DT_DEFAULT_IDLE;
+    g.bulk_free = 1;
+    g.rss_hash = RT_RSS_IP_L4;
+    g.tx_drain = RT_TX_DRAIN_LOOP;
+    g.tx_drain_us = RT_TX_DRAIN_DEFAULT_US;
+    g.tx_hold_us = RT_TX_HOLD_DEFAULT_US;
+    g.power_intr_ms = RT_PWR_INTR_DEFAULT_MS;
+    g.ctrl_lcore = -1;
+    g.punt_rate = RT_PUNT_DEFAULT_RATE;
+    g.capture_ports = ~0LU;
+    g.capture_sample = 1;
+    g.capture_snaplen = RT_CAP_DEFAULT_SNAPLEN;
+    g.ar_queue_depth = RT_AR_DEFAULT_QUEUE_DEPTH;
+    g.ar_reachable = RT_AR_DEFAULT_REACHABLE;
+    g.ar_stale = RT_AR_DEFAULT_STALE;
 }
 
 #define MAX_RX_QUEUE_PER_LCORE 16
+#define MAX_RX_QUEUE_PER_PORT 16
 #define MAX_TX_QUEUE_PER_PORT 16
 
 #define MAX_TIMER_PERIOD 86400 /* 1 day max */
@@ -6,6 +6,8 @@
 #include "tables.h"
 #include "functions.h"
 #include "dbgmsg.h"
+#include "classify.h"
+#include "slowpath.h"
 
 static inline void
 rt_pkt_ipv4_local_process (rt_pkt_t pkt)
@@ -39,22 +41,32 @@ void
 rt_pkt_setup_dt (rt_port_info_t *i_pi, rt_ipv4_addr_t ipda,
     rt_lpm_t *rt, rt_ipv4_ar_t *ar)
 {
+    /* Generations first: see rt_dt_depend() */
+    uint32_t rt_gen = __atomic_load_n(&rt->dt_gen, __ATOMIC_ACQUIRE);
+    uint32_t ar_gen = (ar != NULL)
+        ? __atomic_load_n(&ar->dt_gen, __ATOMIC_ACQUIRE) : 0;
     /* Egress Port Info */
     rt_port_info_t *e_pi = rt->pi;
     /* Create Direct-Table Entry */
-    rt_dt_route_t dt;
-    memset(&dt, 0, sizeof(dt));
-    dt.key.prtidx = i_pi->idx;
-    dt.key.ipaddr = ipda;
-    dt.pi = e_pi;
-    dt.port = e_pi->idx;
-    dt.flags = rt->flags & RT_FWD_F_MASK;
-    memcpy(dt.key.hwaddr, i_pi->hwaddr, 6);
+    rt_dt_key_t key;
+    rt_dt_fwd_t fwd;
+    memset(&key, 0, sizeof(key));
+    memset(&fwd, 0, sizeof(fwd));
+    key.prtidx = i_pi->idx;
+    key.ipaddr = ipda;
+    memcpy(key.hwaddr, i_pi->hwaddr, 6);
+    fwd.pi = e_pi;
+    fwd.port = e_pi->idx;
+    fwd.flags = rt->flags & RT_FWD_F_MASK;
     if (ar != NULL) {
-        memcpy(dt.eth.dst, ar->hwaddr, 6);
+        memcpy(fwd.eth.dst, ar->hwaddr, 6);
+    }
+    memcpy(fwd.eth.src, e_pi->hwaddr, 6);
+    fwd.rtcntidx = rt->cntidx;
+    rt_dt_route_t *dt = rt_dt_create(&key, &fwd);
+    if (dt != NULL) {
+        rt_dt_depend(dt, rt, rt_gen, ar, ar_gen);
     }
-    memcpy(dt.eth.src, e_pi->hwaddr, 6);
-    rt_dt_create(&dt);
 }
 
 void
@@ -75,9 +87,16 @@ rt_pkt_ipv4_send (rt_pkt_t pkt, rt_ipv4_addr_t ipda, int flags)
     uint32_t rt_flags = rt->flags;
     rt_ipv4_addr_t nhipa = ipda;
 
+    rt_stats_incr(rt->cntidx, rt_pkt_length(pkt));
+
     if (rt_flags & RT_FWD_F_LOCAL) {
         if (pkt.pi != NULL) {
-            rt_dt_create_exception(pkt.pi, ipda, RT_FWD_F_LOCAL);
+            uint32_t rt_gen = __atomic_load_n(&rt->dt_gen, __ATOMIC_ACQUIRE);
+            rt_dt_route_t *dt =
+                rt_dt_create_exception(pkt.pi, ipda, RT_FWD_F_LOCAL);
+            if (dt != NULL) {
+                rt_dt_depend(dt, rt, rt_gen, NULL, 0);
+            }
         }
         rt_pkt_ipv4_local_process(pkt);
         return;
@@ -151,8 +170,16 @@ rt_pkt_ipv4_process (rt_pkt_t pkt, rt_ipv4_addr_t ipda)
  * Fast Dirct-Table Packet Processing
  */
 static inline void
-rt_pkt_dt_process (rt_pkt_t pkt, rt_dt_route_t *drp)
+rt_pkt_dt_process (rt_pkt_t pkt, const rt_dt_fwd_t *drp)
 {
+    uint32_t len = rt_pkt_length(pkt);
+    rt_stats_incr(drp->cntidx, len);
+    if (unlikely(drp->flags & RT_FWD_F_INVALID)) {
+        /* Next hop moved or expired - resolve again (and rebuild) */
+        rt_pkt_ipv4_send(pkt, ntohl(*PTR(pkt.pp.l3, uint32_t, 16)), 0);
+        return;
+    }
+    rt_stats_incr(drp->rtcntidx, len);
     if (unlikely(drp->flags)) {
         if (drp->flags & RT_FWD_F_DISCARD) {
             rt_pkt_discard(pkt, RT_DISC_DROP);
@@ -177,33 +204,23 @@ rt_pkt_dt_process (rt_pkt_t pkt, rt_dt_route_t *drp)
     rt_pkt_send_fast(pkt, drp->port);
 }
 
-void
-rt_pkt_process (int port, struct rte_mbuf *mbuf)
+static inline void
+rt_pkt_init (rt_pkt_t *pkt, rt_port_info_t *pi, struct rte_mbuf *mbuf)
 {
-    rt_pkt_t pkt;
-    pkt.pi = rt_port_lookup(port);
-    pkt.rdidx = pkt.pi->rdidx;
-    pkt.mbuf = mbuf;
-    pkt.eth = rte_pktmbuf_mtod(mbuf, void *);
-    rt_disc_cause_t reason = RT_DISC_IGNORE;
-
-    uint16_t ethtype = ntohs(pkt.eth->ethtype);
-
-    pkt.pp.l3 = PTR(pkt.eth, void, 14);
-    rt_ipv4_addr_t ipda = ntohl(*PTR(pkt.pp.l3, uint32_t, 16));
+    pkt->pi = pi;
+    pkt->rdidx = pi->rdidx;
+    pkt->mbuf = mbuf;
+    pkt->eth = rte_pktmbuf_mtod(mbuf, void *);
+    pkt->pp.l3 = PTR(pkt->eth, void, 14);
+}
 
-    /* Look-up in Direct (fast) Table */
-    if (likely(ethtype == 0x0800)) {
-        rt_dt_key_t dt_key;
-        dt_key.prtidx = port;
-        dt_key.ipaddr = ipda;
-        memcpy(dt_key.hwaddr, pkt.eth->dst, 6);
-        rt_dt_route_t *drp = rt_dt_lookup(&dt_key);
-        if (likely(drp != NULL)) {
-            rt_pkt_dt_process(pkt, drp);
-            return;
-        }
-    }
+/*
+ * Slow Path: everything that missed in the Direct Table
+ */
+static void
+rt_pkt_slow_process (rt_pkt_t pkt, uint16_t ethtype, rt_ipv4_addr_t ipda)
+{
+    rt_disc_cause_t reason = RT_DISC_IGNORE;
 
     if (likely(rt_pkt_is_unicast(pkt))) {
         /* Unicast - Compare Destination MAC address */
@@ -238,3 +255,139 @@ rt_pkt_process (int port, struct rte_mbuf *mbuf)
   Discard:
     rt_pkt_discard(pkt, reason);
 }
+
+void
+rt_pkt_process (int port, struct rte_mbuf *mbuf)
+{
+    rt_pkt_t pkt;
+    rt_pkt_init(&pkt, rt_port_lookup(port), mbuf);
+
+    uint16_t ethtype = ntohs(pkt.eth->ethtype);
+    rt_ipv4_addr_t ipda = ntohl(*PTR(pkt.pp.l3, uint32_t, 16));
+
+    /* Look-up in Direct (fast) Table */
+    if (likely(ethtype == 0x0800)) {
+        rt_dt_key_t dt_key;
+        dt_key.prtidx = port;
+        dt_key.ipaddr = ipda;
+        memcpy(dt_key.hwaddr, pkt.eth->dst, 6);
+        const rt_dt_fwd_t *drp = rt_dt_lookup(&dt_key);
+        if (likely(drp != NULL)) {
+            rt_pkt_dt_process(pkt, drp);
+            return;
+        }
+    }
+
+    rt_pkt_slow_process(pkt, ethtype, ipda);
+}
+
+/*
+ * Control lcore: a packet punted by a forwarding lcore. The DT is
+ * looked up again, as the entry may have been created, rebuilt or
+ * invalidated in the meantime; the miss was counted when punting.
+ */
+void
+rt_pkt_punt_process (struct rte_mbuf *mbuf)
+{
+    rt_pkt_t pkt;
+    rt_pkt_init(&pkt, rt_port_lookup(mbuf->port), mbuf);
+
+    uint16_t ethtype = ntohs(pkt.eth->ethtype);
+    rt_ipv4_addr_t ipda = ntohl(*PTR(pkt.pp.l3, uint32_t, 16));
+
+    if (likely(ethtype == 0x0800)) {
+        rt_dt_key_t dt_key;
+        dt_key.prtidx = mbuf->port;
+        dt_key.ipaddr = ipda;
+        memcpy(dt_key.hwaddr, pkt.eth->dst, 6);
+        const rt_dt_route_t *rp = rt_dt_route_find(&dt_key);
+        if (rp != NULL) {
+            rt_pkt_dt_process(pkt, rt_rcu_dereference(rp->fwd));
+            return;
+        }
+    }
+
+    rt_pkt_slow_process(pkt, ethtype, ipda);
+}
+
+/*
+ * Process a received burst in stages so that the memory accesses of
+ * all packets overlap: (1) prefetch packet headers, (2) classify
+ * headers (classify.c), prefetch DT buckets, (3) prefetch candidate
+ * DT entries, (4) resolve entries, prefetch forwarding info,
+ * (5) forward.
+ * Packets that miss in the DT fall back to the per-packet slow path,
+ * which runs on the control lcore if there is one (see slowpath.h).
+ */
+void
+rt_pkt_process_burst (int port, struct rte_mbuf **mbufs, int count)
+{
+    rt_port_info_t *pi = rt_port_lookup(port);
+    rt_pkt_class_t pc;
+    const rt_dt_route_t *routes[MAX_PKT_BURST];
+    int idx;
+
+    for (idx = 0 ; idx < count ; idx++) {
+        rte_prefetch0(rte_pktmbuf_mtod(mbufs[idx], void *));
+    }
+
+    if (rt_cap_wanted(RT_CAP_RX, port)) {
+        for (idx = 0 ; idx < count ; idx++)
+            rt_cap_packet(mbufs[idx], port, RT_CAP_RX);
+    }
+
+    rt_classify_burst(mbufs, count, port, &pc);
+
+    for (idx = 0 ; idx < count ; idx++) {
+        rt_dt_prefetch_bucket(pc.hash[idx]);
+    }
+
+    for (idx = 0 ; idx < count ; idx++) {
+        if (likely(pc.ethtype[idx] == 0x0800))
+            rt_dt_prefetch_routes(pc.hash[idx]);
+    }
+
+    uint64_t miss = 0;
+    for (idx = 0 ; idx < count ; idx++) {
+        const rt_dt_route_t *rp = NULL;
+        if (likely(pc.ethtype[idx] == 0x0800)) {
+            rp = rt_dt_route_find_hash(&pc.key[idx], pc.hash[idx]);
+            if (likely(rp != NULL)) {
+                rte_prefetch0(rt_rcu_dereference(rp->fwd));
+                rt_dt_touch(rp);
+            } else {
+                miss++;
+                if (rt_cap_wanted(RT_CAP_MISS, port))
+                    rt_cap_packet(mbufs[idx], port, RT_CAP_MISS);
+            }
+        }
+        routes[idx] = rp;
+    }
+    if (miss != 0)
+        rt_lcore_stats_self()->dt_miss += miss;
+
+    int punt = rt_punt_active();
+    for (idx = 0 ; idx < count ; idx++) {
+        rt_pkt_t pkt;
+        rt_pkt_init(&pkt, pi, mbufs[idx]);
+        if (likely(routes[idx] != NULL)) {
+            const rt_dt_fwd_t *drp = rt_rcu_dereference(routes[idx]->fwd);
+            if (unlikely(drp->flags & (RT_FWD_F_LOCAL | RT_FWD_F_INVALID))
+                    && punt) {
+                rt_punt(pkt);
+                continue;
+            }
+            rt_pkt_dt_process(pkt, drp);
+            continue;
+        }
+        /* Anything but IPv4 and ARP is only discarded */
+        if (punt && ((pc.ethtype[idx] == 0x0800)
+                || (pc.ethtype[idx] == 0x0806))) {
+            rt_punt(pkt);
+            continue;
+        }
+        rt_pkt_slow_process(pkt, pc.ethtype[idx], pc.key[idx].ipaddr);
+    }
+    if (punt)
+        rt_punt_flush();
+}
@@ -6,6 +6,8 @@
 #include "tables.h"
 
 void rt_pkt_process (int port, struct rte_mbuf *m);
+void rt_pkt_process_burst (int port, struct rte_mbuf **mbufs, int count);
+void rt_pkt_punt_process (struct rte_mbuf *mbuf);
 
 void rt_pkt_setup_dt (rt_port_info_t *i_pi, rt_ipv4_addr_t ipda,
     rt_lpm_t *rt, rt_ipv4_ar_t *ar);
@@ -15,6 +17,7 @@ void rt_pkt_ipv4_send (rt_pkt_t pkt, rt_ipv4_addr_t ipda, int flags);
 
 void rt_arp_process (rt_pkt_t pkt);
 void rt_arp_generate (rt_pkt_t pkt, rt_ipv4_addr_t ipda, rt_lpm_t *rt);
+void rt_arp_request (rt_port_info_t *pi, rt_ipv4_addr_t ipda);
 void rt_arp_send_gratuitous (rt_port_info_t *pi);
 
 void rt_icmp_process (rt_pkt_t pkt);
@@ -23,6 +26,7 @@ void rt_icmp_gen_request (rt_rd_t rdidx, rt_ipv4_addr_t ipda);
 void rt_dhcp_process (rt_pkt_t pkt);
 void rt_dhcp_discover (void);
 
+uint64_t rt_peek_portmask (int argc, char **argv);
 int rt_parse_args (int argc, char **argv);
 
 #endif
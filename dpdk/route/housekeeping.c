@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <rte_debug.h>
+#include <rte_cycles.h>
+
+#include "defines.h"
+#include "tables.h"
+#include "rings.h"
+#include "stats.h"
+#include "rcu.h"
+#include "dbgmsg.h"
+#include "housekeeping.h"
+
+static pthread_t rt_hk_thread;
+static int rt_hk_running = 0;
+
+static void *
+rt_hk_main (void *arg)
+{
+    tx_ring_set_t *grs = (tx_ring_set_t *) arg;
+
+    rt_stats_thread_slot(RT_STATS_HK_SLOT);
+
+    /* Packets (ARP requests) go through a private queue set */
+    tx_queue_set_t *qs = create_queue_set(grs);
+
+    uint64_t hz = rte_get_timer_hz();
+    uint64_t start = rte_get_timer_cycles();
+
+    rt_rcu_online(RT_RCU_HK_SLOT);
+
+    while (!g.force_quit) {
+        usleep(RT_HK_PERIOD_US);
+
+        rt_dt_clock = 1 + (rte_get_timer_cycles() - start) / hz;
+
+        rt_ipv4_ar_timer_run();
+        rt_dt_sweep();
+
+        tx_queue_flush_all(qs);
+        pktmbuf_free_flush();
+
+        rt_rcu_quiescent(RT_RCU_HK_SLOT);
+        rt_rcu_reclaim();
+    }
+
+    rt_rcu_offline(RT_RCU_HK_SLOT);
+    return NULL;
+}
+
+void
+rt_hk_start (tx_ring_set_t *grs)
+{
+    int rc = pthread_create(&rt_hk_thread, NULL, rt_hk_main, grs);
+    if (rc != 0) {
+        rte_exit(EXIT_FAILURE, "Cannot create housekeeping thread\n");
+    }
+    rt_hk_running = 1;
+    dbgmsg(CONF, nopkt, "Housekeeping thread started (period %u us)",
+        RT_HK_PERIOD_US);
+}
+
+void
+rt_hk_stop (void)
+{
+    if (rt_hk_running) {
+        pthread_join(rt_hk_thread, NULL);
+        rt_hk_running = 0;
+    }
+}
@@ -0,0 +1,18 @@
+#ifndef __RT_HOUSEKEEPING_H__
+#define __RT_HOUSEKEEPING_H__
+
+#include "tables.h"
+#include "rings.h"
+
+/*
+ * Housekeeping thread: periodic table maintenance (ARP aging) that
+ * must not run on the forwarding lcores. It is a plain pthread, not
+ * an EAL lcore.
+ */
+
+#define RT_HK_PERIOD_US (RT_AR_TW_TICK_MS * 1000)
+
+void rt_hk_start (tx_ring_set_t *grs);
+void rt_hk_stop (void);
+
+#endif
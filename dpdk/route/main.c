@@ -77,6 +77,14 @@
 #include "dbgmsg.h"
 #include "rings.h"
 #include "stats.h"
+#include "rcu.h"
+#include "classify.h"
+#include "housekeeping.h"
+#include "numa.h"
+#include "balance.h"
+#include "power.h"
+#include "slowpath.h"
+#include "capture.h"
 #include "port-process.h"
 
 rt_global_t g;
@@ -84,7 +92,6 @@ rt_global_t g;
 #define RTE_LOGTYPE_ROUTE RTE_LOGTYPE_USER1
 
 #define BURST_TX_DRAIN_US 100 /* TX drain every ~100us */
-#define MEMPOOL_CACHE_SIZE 256
 
 tx_ring_set_t *grs = NULL;
 
@@ -105,12 +112,16 @@ rt_main_loop (void)
 
     tx_queue_set_t *qs = create_queue_set(grs);
     tx_ring_set_t *trs = create_thread_ring_set(grs);
-    rt_queue_list_t *rx_queue_list = create_thread_rx_queue_list(lcore_id);
+    rt_balance_register(lcore_id);
+    const rt_queue_list_t *rx_queue_list = rt_balance_queue_list(lcore_id);
 
     rt_port_log_queue_list(lcore_id, rx_queue_list);
 
+    /* With --rx-balance, idle lcores stay around to take queues */
     if ((rx_queue_list->count == 0)
             && (trs->count == 0)
+            && (g.rx_balance_tsc == 0)
+            && ((int) lcore_id != g.ctrl_lcore)
             && (lcore_id != rte_get_master_lcore())) {
         RTE_LOG(INFO, ROUTE, "lcore %u has nothing to do\n", lcore_id);
         return;
@@ -118,8 +129,16 @@ rt_main_loop (void)
 
     RTE_LOG(INFO, ROUTE, "entering main loop on lcore %u\n", lcore_id);
 
+    rt_rcu_online(lcore_id);
+
     while (!g.force_quit) {
 
+        /* No table references are held across iterations */
+        rt_rcu_quiescent(lcore_id);
+
+        /* The RX queue list may have been replaced (rebalancing) */
+        rx_queue_list = rt_balance_queue_list(lcore_id);
+
         cur_tsc = rte_rdtsc();
 
         /*
@@ -143,6 +162,16 @@ rt_main_loop (void)
 
                         if (g.print_statistics) {
                             print_stats();
+                            rt_dt_print_stats(stdout);
+                            rt_balance_print_stats(stdout);
+                            rt_power_print_stats(stdout);
+                            rt_punt_print_stats(stdout);
+                            dbgmsg_print_stats(stdout);
+                            rt_cap_print_stats(stdout);
+                            if (g.dt_histogram)
+                                rt_dt_histogram(stdout);
+                            if (g.top_counters > 0)
+                                rt_cnt_print_top(stdout, g.top_counters);
                         }
                         if (g.ping_nexthops) {
                             rt_lpm_gen_icmp_requests();
@@ -156,18 +185,44 @@ rt_main_loop (void)
                 }
             }
 
+            /* release table entries retired by this lcore */
+            rt_rcu_reclaim();
+
+            if (lcore_id == rte_get_master_lcore())
+                rt_balance_run(cur_tsc);
+
             prev_tsc = cur_tsc;
         }
 
         /*
          * Read packet from RX queues and process them
          */
-        rx_port_process_task_list(rx_queue_list);
+        qs->now = cur_tsc;
+        int rxcnt = rx_port_process_task_list(rx_queue_list);
 
-        tx_queue_flush_all(qs);
+        /* Slow path for what the forwarding lcores punted */
+        if ((int) lcore_id == g.ctrl_lcore)
+            rxcnt += rt_punt_process();
+
+        /* Send what the TX drain policy says is due */
+        tx_queue_drain(qs, rxcnt == 0);
+
+        flush_thread_ring_set(trs, cur_tsc, rxcnt == 0);
+
+        pktmbuf_free_flush();
+
+        if (rxcnt > 0) {
+            rt_lcore_stats_t *ls = rt_lcore_stats_self();
+            ls->busy_cycles += rte_rdtsc() - cur_tsc;
+            ls->busy_pkts += rxcnt;
+        }
 
-        flush_thread_ring_set(trs);
+        /* Back off when idle (--power) */
+        if (g.power)
+            rt_power_poll(lcore_id, rx_queue_list, qs, trs, rxcnt, cur_tsc);
     }
+
+    rt_rcu_offline(lcore_id);
 }
 
 static int
@@ -189,7 +244,6 @@ signal_handler (int signum)
 int
 main (int argc, char **argv)
 {
-    struct rte_eth_dev_info dev_info;
     int rc;
     uint8_t nb_ports;
     rt_lcore_id_t lcore_id;
@@ -207,9 +261,10 @@ main (int argc, char **argv)
 
     rt_global_init();
     rt_stats_init();
+    rt_rcu_init();
     dbgmsg_init();
+    rt_numa_init(rt_peek_portmask(argc, argv));
     rt_lpm_table_init();
-    rt_dt_init ();
     rt_port_table_init();
     rt_lat_init();
     rt_ar_table_init();
@@ -219,8 +274,21 @@ main (int argc, char **argv)
     if (rc < 0)
         return -1;
 
+    rt_dt_init(g.dt_size, g.dt_budget);
+    rt_classify_init();
+    rt_numa_report(stdout);
+
     /* convert to number of cycles */
     g.timer_period *= rte_get_timer_hz();
+    g.tx_drain_tsc = (rte_get_tsc_hz() + US_PER_S - 1) / US_PER_S
+        * g.tx_drain_us;
+    g.tx_hold_tsc = (rte_get_tsc_hz() + US_PER_S - 1) / US_PER_S
+        * g.tx_hold_us;
+    g.rx_balance_tsc = (rte_get_tsc_hz() + MS_PER_S - 1) / MS_PER_S
+        * g.rx_balance_ms;
+    rt_power_init();
+    rt_punt_init();
+    rt_cap_init();
 
     #if RTE_VERSION < RTE_VERSION_NUM(18,5,0,0)
     nb_ports = rte_eth_dev_count();
@@ -231,21 +299,13 @@ main (int argc, char **argv)
         rte_exit(EXIT_FAILURE, "No Ethernet ports - bye\n");
 
     /*
-     * Each logical core is assigned a dedicated TX queue on each port.
+     * Each logical core is assigned a dedicated TX queue on each port
+     * (--direct-tx), if the port has enough of them.
      */
-    FOREACH_PORT(prtidx) {
-        rte_eth_dev_info_get(prtidx, &dev_info);
-    }
-
-    int mbuf_count = rt_port_desc_count()
-        + RTE_MBUF_DESC_MARGIN;
+    rt_port_tx_queue_assign();
 
-    /* create the mbuf pool */
-    rt_pktmbuf_pool = rte_pktmbuf_pool_create("mbuf_pool", mbuf_count,
-        MEMPOOL_CACHE_SIZE, 0, RTE_MBUF_DEFAULT_BUF_SIZE,
-        rte_socket_id());
-    if (rt_pktmbuf_pool == NULL)
-        rte_exit(EXIT_FAILURE, "Cannot init mbuf pool\n");
+    /* create the mbuf pools, one per socket with ports */
+    rt_pktmbuf_pool = rt_numa_mbuf_init();
 
     grs = create_global_ring_set(nb_ports);
 
@@ -262,8 +322,12 @@ main (int argc, char **argv)
 
     rt_check_all_ports_link_status();
 
+    rt_numa_check_placement();
+
     rc = 0;
 
+    rt_hk_start(grs);
+
     /* launch per-lcore init on every lcore */
     rte_eal_mp_remote_launch(rt_launch_one_lcore, NULL, CALL_MASTER);
 
@@ -274,6 +338,12 @@ main (int argc, char **argv)
         }
     }
 
+    rt_hk_stop();
+
+    /* Write out what is left in the log rings and the capture ring */
+    dbgmsg_close();
+    rt_cap_close();
+
     FOREACH_PORT(prtidx) {
         printf("Closing port %d...", prtidx);
         rte_eth_dev_stop(prtidx);
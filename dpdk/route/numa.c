@@ -0,0 +1,303 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <rte_common.h>
+#include <rte_version.h>
+#include <rte_memory.h>
+#include <rte_malloc.h>
+#include <rte_lcore.h>
+#include <rte_ethdev.h>
+#include <rte_mempool.h>
+#include <rte_mbuf.h>
+
+#include "numa.h"
+#include "port.h"
+#include "dbgmsg.h"
+
+int rt_numa_table_socket = SOCKET_ID_ANY;
+
+/* mbind() policy (<numaif.h>), without linking libnuma */
+#define RT_MPOL_PREFERRED   1
+
+typedef struct {
+    char name[32];
+    size_t size;
+    int socket;         /* Where it actually landed */
+    int lazy;           /* Not hugepage memory (rt_numa_lazy_alloc) */
+} rt_numa_table_t;
+
+static rt_numa_table_t rt_numa_tables[RT_NUMA_MAX_TABLES];
+static int rt_numa_table_count;
+
+static struct rte_mempool *rt_numa_mbuf_pools[RTE_MAX_NUMA_NODES];
+static struct rte_mempool *rt_numa_mbuf_default;
+
+/*
+ * Home the tables on the socket most enabled ports are attached to.
+ * Without any socket information (single socket, virtual devices)
+ * the master lcore's socket is used.
+ */
+void
+rt_numa_init (uint64_t port_mask)
+{
+    int count[RTE_MAX_NUMA_NODES];
+    int prtidx, socket, best = -1;
+
+    memset(count, 0, sizeof(count));
+    for (prtidx = 0 ; prtidx < RT_MAX_PORT_COUNT ; prtidx++) {
+        if ((port_mask & (1LU << prtidx)) == 0)
+            continue;
+        socket = rte_eth_dev_socket_id(prtidx);
+        if ((socket < 0) || (socket >= RTE_MAX_NUMA_NODES))
+            continue;
+        count[socket]++;
+        if ((best < 0) || (count[socket] > count[best]))
+            best = socket;
+    }
+    rt_numa_table_socket = (best >= 0) ? best : (int) rte_socket_id();
+    dbgmsg(CONF, nopkt, "Route tables on socket %d", rt_numa_table_socket);
+}
+
+/*
+ * Returns the socket of hugepage memory at 'ptr', SOCKET_ID_ANY if it
+ * is not hugepage memory.
+ */
+int
+rt_numa_socket_of (const void *ptr)
+{
+#if RTE_VERSION >= RTE_VERSION_NUM(18,5,0,0)
+    const struct rte_memseg *ms = rte_mem_virt2memseg(ptr, NULL);
+    return (ms != NULL) ? ms->socket_id : SOCKET_ID_ANY;
+#else
+    const struct rte_memseg *ms = rte_eal_get_physmem_layout();
+    int i;
+    for (i = 0 ; (i < RTE_MAX_MEMSEG) && (ms[i].addr != NULL) ; i++) {
+        const char *start = (const char *) ms[i].addr;
+        if (((const char *) ptr >= start)
+                && ((const char *) ptr < start + ms[i].len))
+            return ms[i].socket_id;
+    }
+    return SOCKET_ID_ANY;
+#endif
+}
+
+static void *
+rt_numa_alloc (const char *name, size_t size, unsigned align)
+{
+    void *ptr = rte_zmalloc_socket(name, size, align, rt_numa_table_socket);
+    if (ptr == NULL) {
+        /* Out of hugepages on the home socket: any socket will do */
+        ptr = rte_zmalloc_socket(name, size, align, SOCKET_ID_ANY);
+    }
+    return ptr;
+}
+
+/*
+ * Allocate a zeroed, cache-line aligned table. Does not return on
+ * failure.
+ */
+void *
+rt_numa_table_alloc (const char *name, size_t size)
+{
+    void *ptr = rt_numa_alloc(name, size, RTE_CACHE_LINE_SIZE);
+    if (ptr == NULL)
+        rte_exit(EXIT_FAILURE, "Cannot allocate %s (%zu bytes)\n",
+            name, size);
+    int socket = rt_numa_socket_of(ptr);
+    if (rt_numa_table_count < RT_NUMA_MAX_TABLES) {
+        rt_numa_table_t *tp = &rt_numa_tables[rt_numa_table_count++];
+        snprintf(tp->name, sizeof(tp->name), "%s", name);
+        tp->size = size;
+        tp->socket = socket;
+    }
+    if (socket != rt_numa_table_socket) {
+        dbgmsg(WARN, nopkt, "%s allocated on socket %d instead of %d",
+            name, socket, rt_numa_table_socket);
+    }
+    return ptr;
+}
+
+/*
+ * Allocate a large, sparsely used zeroed table (the LPM arrays)
+ * outside hugepage memory: anonymous pages are only backed once
+ * touched, so the table costs memory for the part in use and does
+ * not compete with the mbuf pools for hugepages. The pages are taken
+ * from the home socket if it has any free. Does not return on
+ * failure.
+ */
+void *
+rt_numa_lazy_alloc (const char *name, size_t size)
+{
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (ptr == MAP_FAILED)
+        rte_exit(EXIT_FAILURE, "Cannot allocate %s (%zu bytes)\n",
+            name, size);
+    if ((rt_numa_table_socket >= 0) && (rt_numa_table_socket < 64)) {
+        unsigned long mask = 1UL << rt_numa_table_socket;
+        /* Fails on kernels without NUMA: any memory will do then */
+        if (syscall(SYS_mbind, ptr, size, RT_MPOL_PREFERRED, &mask,
+                sizeof(mask) * 8, 0) < 0)
+            dbgmsg(DEBUG, nopkt, "%s: cannot bind to socket %d", name,
+                rt_numa_table_socket);
+    }
+    if (rt_numa_table_count < RT_NUMA_MAX_TABLES) {
+        rt_numa_table_t *tp = &rt_numa_tables[rt_numa_table_count++];
+        snprintf(tp->name, sizeof(tp->name), "%s", name);
+        tp->size = size;
+        tp->socket = rt_numa_table_socket;
+        tp->lazy = 1;
+    }
+    return ptr;
+}
+
+/* Allocate a zeroed table entry */
+void *
+rt_numa_entry_alloc (size_t size)
+{
+    void *ptr = rt_numa_alloc(NULL, size, 0);
+    assert(ptr != NULL);
+    return ptr;
+}
+
+void
+rt_numa_free (void *ptr)
+{
+    rte_free(ptr);
+}
+
+void
+rt_numa_report (FILE *fd)
+{
+    int i;
+    fprintf(fd, "Table memory (home socket %d):\n", rt_numa_table_socket);
+    for (i = 0 ; i < rt_numa_table_count ; i++) {
+        const rt_numa_table_t *tp = &rt_numa_tables[i];
+        fprintf(fd, "  %-24s %10zu KB  socket %d%s\n", tp->name,
+            tp->size >> 10, tp->socket,
+            tp->lazy ? " (not hugepages, backed on use)"
+            : (tp->socket != rt_numa_table_socket) ? " (REMOTE)" : "");
+    }
+    fflush(fd);
+}
+
+int
+rt_numa_port_socket (int prtidx)
+{
+    int socket = rte_eth_dev_socket_id(prtidx);
+    if ((socket < 0) || (socket >= RTE_MAX_NUMA_NODES))
+        return rt_numa_table_socket;
+    return socket;
+}
+
+int
+rt_numa_lcore_socket (unsigned lcore)
+{
+    int socket = rte_lcore_to_socket_id(lcore);
+    if ((socket < 0) || (socket >= RTE_MAX_NUMA_NODES))
+        return rt_numa_table_socket;
+    return socket;
+}
+
+/*
+ * Create one mbuf pool per socket that has enabled ports. Returns the
+ * pool of the table socket (or the first one created), which is used
+ * for packets generated by threads on sockets without a pool. Does
+ * not return on failure.
+ */
+struct rte_mempool *
+rt_numa_mbuf_init (void)
+{
+    int socket;
+    for (socket = 0 ; socket < RTE_MAX_NUMA_NODES ; socket++) {
+        int count = rt_port_desc_count(socket);
+        if (count == 0)
+            continue;
+        count += RTE_MBUF_DESC_MARGIN;
+        char name[RTE_MEMPOOL_NAMESIZE];
+        snprintf(name, sizeof(name), "mbuf_pool_%d", socket);
+        struct rte_mempool *mp = rte_pktmbuf_pool_create(name, count,
+            MEMPOOL_CACHE_SIZE, 0, RTE_MBUF_DEFAULT_BUF_SIZE, socket);
+        if (mp == NULL) {
+            dbgmsg(WARN, nopkt, "No hugepages for %s on socket %d,"
+                " using any socket", name, socket);
+            mp = rte_pktmbuf_pool_create(name, count,
+                MEMPOOL_CACHE_SIZE, 0, RTE_MBUF_DEFAULT_BUF_SIZE,
+                SOCKET_ID_ANY);
+        }
+        if (mp == NULL)
+            rte_exit(EXIT_FAILURE, "Cannot init mbuf pool on socket %d\n",
+                socket);
+        dbgmsg(CONF, nopkt, "%s: %d mbufs", name, count);
+        rt_numa_mbuf_pools[socket] = mp;
+        if ((rt_numa_mbuf_default == NULL)
+                || (socket == rt_numa_table_socket))
+            rt_numa_mbuf_default = mp;
+    }
+    if (rt_numa_mbuf_default == NULL)
+        rte_exit(EXIT_FAILURE, "Cannot init mbuf pool: no ports\n");
+    return rt_numa_mbuf_default;
+}
+
+/* The mbuf pool local to 'socket', or the default pool */
+struct rte_mempool *
+rt_numa_mbuf_pool (int socket)
+{
+    if ((socket >= 0) && (socket < RTE_MAX_NUMA_NODES)
+            && (rt_numa_mbuf_pools[socket] != NULL))
+        return rt_numa_mbuf_pools[socket];
+    return rt_numa_mbuf_default;
+}
+
+/*
+ * Warn about lcores that serve a port on another socket. Every packet
+ * such an lcore handles crosses the socket interconnect at least
+ * twice (descriptor and header reads, mbuf writeback), so the share
+ * of the port's traffic involved is logged, along with the bandwidth
+ * it amounts to at link speed. RX queues are assumed to get an equal
+ * share of the RSS traffic. With --direct-tx the TX lcore only drains
+ * rings, and is not counted.
+ */
+void
+rt_numa_check_placement (void)
+{
+    FOREACH_PORT(prtidx) {
+        rt_port_info_t *pi = rt_port_lookup(prtidx);
+        int socket = rt_numa_port_socket(prtidx);
+        int qidx, remote = 0;
+
+        for (qidx = 0 ; qidx < pi->rx_q_count ; qidx++) {
+            rt_lcore_id_t lcore = pi->rxq_lcore[qidx];
+            if (rt_numa_lcore_socket(lcore) == socket)
+                continue;
+            dbgmsg(WARN, nopkt, "Port %u (socket %d): RX queue %d polled"
+                " by lcore %u on socket %d", prtidx, socket, qidx,
+                lcore, rt_numa_lcore_socket(lcore));
+            remote++;
+        }
+        int tx_remote = !g.direct_tx
+            && (rt_numa_lcore_socket(pi->tx_lcore) != socket);
+        if (tx_remote) {
+            dbgmsg(WARN, nopkt, "Port %u (socket %d): TX by lcore %u"
+                " on socket %d", prtidx, socket, pi->tx_lcore,
+                rt_numa_lcore_socket(pi->tx_lcore));
+        }
+        if ((remote == 0) && !tx_remote)
+            continue;
+
+        struct rte_eth_link link;
+        memset(&link, 0, sizeof(link));
+        rte_eth_link_get_nowait(prtidx, &link);
+        unsigned rx_pct = remote * 100 / pi->rx_q_count;
+        unsigned tx_pct = tx_remote ? 100 : 0;
+        uint64_t mbps = (uint64_t) link.link_speed * (rx_pct + tx_pct) / 100;
+        dbgmsg(WARN, nopkt, "Port %u: %u%% of RX and %u%% of TX cross"
+            " sockets, up to %" PRIu64 " Mbps at line rate", prtidx,
+            rx_pct, tx_pct, mbps);
+    }
+}
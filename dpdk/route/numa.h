@@ -0,0 +1,51 @@
+#ifndef __RT_NUMA_H__
+#define __RT_NUMA_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stddef.h>
+
+#include "defines.h"
+
+/*
+ * Table memory
+ *
+ * The route tables are shared by all forwarding lcores and live in
+ * hugepage memory on one socket: the one most enabled ports are
+ * attached to (rt_numa_init). Large tables are registered by name so
+ * that their placement can be reported at startup; small chained
+ * entries (routes, ARP, local addresses, forwarding info) come from
+ * the same socket. The LPM arrays, large but mostly untouched, are
+ * ordinary memory only backed where used (rt_numa_lazy_alloc).
+ */
+
+#define RT_NUMA_MAX_TABLES  64
+
+extern int rt_numa_table_socket;
+
+void rt_numa_init (uint64_t port_mask);
+void *rt_numa_table_alloc (const char *name, size_t size);
+void *rt_numa_lazy_alloc (const char *name, size_t size);
+void *rt_numa_entry_alloc (size_t size);
+void rt_numa_free (void *ptr);
+int rt_numa_socket_of (const void *ptr);
+void rt_numa_report (FILE *fd);
+
+/*
+ * Packet memory
+ *
+ * Each socket with enabled ports gets its own mbuf pool, sized for the
+ * descriptors of the ports on that socket, so that NICs DMA into local
+ * memory. Ports without socket information count as being on the
+ * table socket.
+ */
+
+struct rte_mempool;
+
+int rt_numa_port_socket (int prtidx);
+int rt_numa_lcore_socket (unsigned lcore);
+struct rte_mempool *rt_numa_mbuf_init (void);
+struct rte_mempool *rt_numa_mbuf_pool (int socket);
+void rt_numa_check_placement (void);
+
+#endif
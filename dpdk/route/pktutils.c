@@ -3,6 +3,7 @@
 #include "defines.h"
 #include "pktutils.h"
 #include "dbgmsg.h"
+#include "numa.h"
 
 #include <rte_ethdev.h>
 
@@ -29,7 +30,7 @@ rt_pkt_create (rt_pkt_t *pkt)
 {
     /* Allocate mbuf */
     assert(rt_pktmbuf_pool != NULL);
-    pkt->mbuf = rte_pktmbuf_alloc(rt_pktmbuf_pool);
+    pkt->mbuf = rte_pktmbuf_alloc(rt_numa_mbuf_pool(rte_socket_id()));
     assert(pkt->mbuf != NULL);
     pkt->eth = rte_pktmbuf_mtod(pkt->mbuf, void *);
 }
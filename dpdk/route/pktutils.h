@@ -11,6 +11,7 @@
 #include "port.h"
 #include "pktdefs.h"
 #include "rings.h"
+#include "capture.h"
 
 #define PTR(ptr, type, offset) \
   ((type *) &(((char *) (ptr))[offset]))
@@ -53,10 +54,15 @@ static inline void
 rt_pkt_discard (rt_pkt_t pkt, rt_disc_cause_t reason)
 {
     assert(pkt.mbuf != NULL);
-    rte_pktmbuf_free(pkt.mbuf);
+    if ((pkt.pi != NULL) && rt_cap_wanted(RT_CAP_DISC(reason), pkt.pi->idx))
+        rt_cap_packet(pkt.mbuf, pkt.pi->idx, RT_CAP_DISC(reason));
+    if (likely(g.bulk_free))
+        pktmbuf_free_later(pkt.mbuf);
+    else
+        rte_pktmbuf_free(pkt.mbuf);
     pkt.mbuf = NULL;
     if (pkt.pi != NULL) {
-        port_statistics[pkt.pi->idx].disc[reason]++;
+        rt_port_stats(pkt.pi->idx)->disc[reason]++;
     }
 }
 
@@ -10,13 +10,14 @@
 
 /*
  * Walk through a lcore-specific list of RX queues to poll packets from.
+ * Returns the number of packets received.
  */
-static inline void
+static inline int
 rx_port_process_task_list (const rt_queue_list_t *ql)
 {
     struct rte_mbuf *pktlist[MAX_PKT_BURST];
-    int idx;
     int count = ql->count;
+    int total = 0;
     const rt_queue_t *qp;
 
     /* Walk through queues assigned to this 'lcore' */
@@ -33,15 +34,13 @@ rx_port_process_task_list (const rt_queue_list_t *ql)
             continue;
 
         /* Update RX statistics */
-        port_statistics[prtidx].rx += pktcnt;
+        rt_port_stats(prtidx)->rx += pktcnt;
+        total += pktcnt;
 
         /* Process Packets */
-        for (idx = 0 ; idx < pktcnt ; idx++) {
-            struct rte_mbuf *m = pktlist[idx];
-            rte_prefetch0(rte_pktmbuf_mtod(m, void *));
-            rt_pkt_process(prtidx, m);
-        }
+        rt_pkt_process_burst(prtidx, pktlist, pktcnt);
     }
+    return total;
 }
 
 #endif
@@ -2,18 +2,36 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <inttypes.h>
 
 #include <rte_common.h>
 #include <rte_cycles.h>
 #include <rte_ether.h>
 #include <rte_ethdev.h>
 #include <rte_malloc.h>
+#include <rte_lcore.h>
 
 #include "defines.h"
 #include "port.h"
 #include "dbgmsg.h"
+#include "stats.h"
+#include "numa.h"
+#include "capture.h"
 
-extern struct rte_mempool * rt_pktmbuf_pool;
+/*
+ * Count unsent packets against the lcore that flushed the buffer
+ */
+static void
+rt_tx_buffer_err_callback (struct rte_mbuf **pkts, uint16_t unsent,
+    void *userdata)
+{
+    rt_port_index_t prtidx = (uintptr_t) userdata;
+    uint16_t idx;
+    rt_cap_qfull(pkts, unsent);
+    for (idx = 0 ; idx < unsent ; idx++)
+        rte_pktmbuf_free(pkts[idx]);
+    rt_port_stats(prtidx)->disc[RT_DISC_QFULL] += unsent;
+}
 
 static void
 log_port_info (rt_port_index_t prtidx)
@@ -36,6 +54,36 @@ log_port_info (rt_port_index_t prtidx)
         di.reta_size);
 }
 
+/*
+ * RSS hash fields for --rss-hash, limited to what the NIC supports.
+ * 'ip' spreads all IPv4 traffic (including ICMP, GRE, fragments) by
+ * addresses only; 'ip-l4' uses ports for TCP/UDP and addresses for
+ * everything else.
+ */
+static uint64_t
+rt_port_rss_hf (rt_port_index_t prtidx, const struct rte_eth_dev_info *di)
+{
+    uint64_t hf = 0;
+    switch (g.rss_hash) {
+    case RT_RSS_IP:
+        hf = ETH_RSS_IP;
+        break;
+    case RT_RSS_L4:
+        hf = ETH_RSS_NONFRAG_IPV4_UDP | ETH_RSS_NONFRAG_IPV4_TCP;
+        break;
+    case RT_RSS_IP_L4:
+        hf = ETH_RSS_IP | ETH_RSS_NONFRAG_IPV4_UDP
+            | ETH_RSS_NONFRAG_IPV4_TCP;
+        break;
+    }
+    if ((hf & di->flow_type_rss_offloads) != hf) {
+        dbgmsg(WARN, nopkt, "Port %u: RSS hash %" PRIx64 " not supported,"
+            " using %" PRIx64, prtidx, hf, hf & di->flow_type_rss_offloads);
+        hf &= di->flow_type_rss_offloads;
+    }
+    return hf;
+}
+
 int
 rt_port_setup (void)
 {
@@ -54,20 +102,44 @@ rt_port_setup (void)
 
         log_port_info(prtidx);
 
+        struct rte_eth_dev_info di;
+        rte_eth_dev_info_get(prtidx, &di);
+        if (pi->rx_q_count > di.max_rx_queues) {
+            rte_exit(EXIT_FAILURE,
+                "Port %u has %u RX queues, %u requested\n",
+                prtidx, di.max_rx_queues, pi->rx_q_count);
+        }
+
         struct rte_eth_conf prtcfg;
         memset(&prtcfg, 0, sizeof(prtcfg));
 
         if (pi->rx_q_count > 1) {
             prtcfg.rxmode.mq_mode = ETH_MQ_RX_RSS;
-            prtcfg.rx_adv_conf.rss_conf.rss_hf
-                = ETH_RSS_NONFRAG_IPV4_UDP
-                | ETH_RSS_NONFRAG_IPV4_TCP;
+            prtcfg.rx_adv_conf.rss_conf.rss_hf = rt_port_rss_hf(prtidx, &di);
+            if (g.rss_key_len > 0) {
+                prtcfg.rx_adv_conf.rss_conf.rss_key = g.rss_key;
+                prtcfg.rx_adv_conf.rss_conf.rss_key_len = g.rss_key_len;
+            }
             prtcfg.txmode.mq_mode = ETH_MQ_TX_NONE;
         }
 
+        /* RX interrupts for --power, if the driver has them */
+        if (g.power && (g.power_intr_ms > 0))
+            prtcfg.intr_conf.rxq = 1;
+
         rc = rte_eth_dev_configure(prtidx,
             pi->rx_q_count, pi->tx_q_count,
             &prtcfg);
+        if ((rc < 0) && prtcfg.intr_conf.rxq) {
+            dbgmsg(WARN, nopkt, "Port %u: no RX interrupts, rc=%d",
+                prtidx, rc);
+            prtcfg.intr_conf.rxq = 0;
+            rc = rte_eth_dev_configure(prtidx,
+                pi->rx_q_count, pi->tx_q_count,
+                &prtcfg);
+        }
+        if (prtcfg.intr_conf.rxq)
+            pi->flags |= RT_PORT_F_RX_INTR;
         if (rc < 0) {
             rte_exit(EXIT_FAILURE,
                 "Cannot configure device: rc=%d, port=%u\n",
@@ -80,7 +152,7 @@ rt_port_setup (void)
         for (qidx = 0 ; qidx < pi->rx_q_count ; qidx++) {
             rc = rte_eth_rx_queue_setup(prtidx, qidx, pi->rx_desc_cnt,
                 rte_eth_dev_socket_id(prtidx),
-                NULL, rt_pktmbuf_pool);
+                NULL, rt_numa_mbuf_pool(rt_numa_port_socket(prtidx)));
             if (rc < 0) {
                 rte_exit(EXIT_FAILURE,
                     "rte_eth_rx_queue_setup: rc=%d, port=%u\n",
@@ -113,8 +185,8 @@ rt_port_setup (void)
         rte_eth_tx_buffer_init(tx_buffer, MAX_PKT_BURST);
 
         rc = rte_eth_tx_buffer_set_err_callback(tx_buffer,
-            rte_eth_tx_buffer_count_callback,
-            &port_statistics[prtidx].disc[RT_DISC_QFULL]);
+            rt_tx_buffer_err_callback,
+            (void *) (uintptr_t) prtidx);
         if (rc < 0) {
             rte_exit(EXIT_FAILURE,
                 "Cannot set error callback for TX buffer on port %u\n",
@@ -139,18 +211,53 @@ rt_port_setup (void)
     return 0;
 }
 
-int rt_port_desc_count (void)
+/*
+ * With --direct-tx, every lcore gets a TX queue of its own on each
+ * port (queue id = lcore index) and transmits without going through
+ * the port's TX ring. The ring stays in use for non-EAL threads.
+ * Ports with fewer TX queues than lcores keep the ring path.
+ */
+void
+rt_port_tx_queue_assign (void)
+{
+    struct rte_eth_dev_info di;
+    unsigned nb_lcores = rte_lcore_count();
+
+    if (!g.direct_tx)
+        return;
+
+    FOREACH_PORT(prtidx) {
+        rt_port_info_t *pi = rt_port_lookup(prtidx);
+        rte_eth_dev_info_get(prtidx, &di);
+        if (di.max_tx_queues < nb_lcores) {
+            dbgmsg(WARN, nopkt, "Port %u: %u TX queues for %u lcores, "
+                "using TX ring", prtidx, di.max_tx_queues, nb_lcores);
+            continue;
+        }
+        pi->tx_q_count = nb_lcores;
+        pi->flags |= RT_PORT_F_DIRECT_TX;
+        dbgmsg(CONF, nopkt, "Port %u: direct TX, %u queues",
+            prtidx, pi->tx_q_count);
+    }
+}
+
+/* Number of descriptors of the ports on 'socket' (SOCKET_ID_ANY: all) */
+int rt_port_desc_count (int socket)
 {
     int count = 0;
 
-    /* Initialise each port */
     FOREACH_PORT(prtidx) {
+        if ((socket != SOCKET_ID_ANY)
+                && (rt_numa_port_socket(prtidx) != socket))
+            continue;
         rt_port_info_t *pi = rt_port_lookup(prtidx);
         count += pi->rx_q_count * pi->rx_desc_cnt
                + pi->tx_q_count * pi->tx_desc_cnt;
     }
 
-    dbgmsg(INFO, nopkt, "Buffers required for ports: %d", count);
+    if (count > 0)
+        dbgmsg(INFO, nopkt, "Buffers required for ports on socket %d: %d",
+            socket, count);
 
     return count;
 }
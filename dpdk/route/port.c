@@ -5,6 +5,7 @@
 #include "port.h"
 #include "dbgmsg.h"
 #include "functions.h"
+#include "numa.h"
 
 rt_port_info_t rt_port_table[RT_MAX_PORT_COUNT];
 
@@ -50,7 +51,10 @@ rt_port_assign_thread (int prtidx, int direction, rt_lcore_id_t lcore)
 {
     rt_port_info_t *pi = rt_port_lookup(prtidx);
     switch (direction) {
-        case RT_PORT_DIR_RX: pi->rx_lcore = lcore; break;
+        case RT_PORT_DIR_RX:
+            pi->rx_lcore = lcore;
+            pi->rxq_lcore[0] = lcore;
+            break;
         case RT_PORT_DIR_TX: pi->tx_lcore = lcore; break;
     }
 }
@@ -66,30 +70,65 @@ rt_port_query_lcore (int prtidx, int direction)
     return RT_PORT_LCORE_UNASSIGNED;
 }
 
+/*
+ * Next enabled lcore at or after 'lcore_id' on 'socket', or on any
+ * socket if none of the enabled lcores is on 'socket'.
+ */
 static inline rt_lcore_id_t
-find_next_lcore_index (rt_lcore_id_t lcore_id)
+find_next_lcore_index (unsigned lcore_id, int socket)
 {
-    for (;;) {
+    unsigned count, any = RTE_MAX_LCORE;
+    for (count = 0 ; count < RTE_MAX_LCORE ; count++, lcore_id++) {
         if (lcore_id >= RTE_MAX_LCORE)
             lcore_id = 0;
-        if (rte_lcore_is_enabled(lcore_id))
+        if (!rte_lcore_is_enabled(lcore_id))
+            continue;
+        /* The control lcore only runs the slow path */
+        if ((int) lcore_id == g.ctrl_lcore)
+            continue;
+        if (rt_numa_lcore_socket(lcore_id) == socket)
             return lcore_id;
-        lcore_id++;
+        if (any == RTE_MAX_LCORE)
+            any = lcore_id;
     }
+    return any;
 }
 
+/*
+ * Assign lcores round-robin to whatever was not pinned, preferring
+ * lcores on the port's socket; each socket has its own round-robin
+ * position. On RX, each queue of a multi-queue port goes to the next
+ * lcore, so the load of one port spreads over several lcores.
+ */
 void
 rt_lcore_default_assign (int direction)
 {
-    rt_lcore_id_t lcore_next_idx = 0;
+    unsigned lcore_next_idx[RTE_MAX_NUMA_NODES];
+    memset(lcore_next_idx, 0, sizeof(lcore_next_idx));
     FOREACH_PORT(prtidx) {
+        int socket = rt_numa_port_socket(prtidx);
+        if (direction == RT_PORT_DIR_RX) {
+            rt_port_info_t *pi = rt_port_lookup(prtidx);
+            int qidx;
+            for (qidx = 0 ; qidx < pi->rx_q_count ; qidx++) {
+                if (pi->rxq_lcore[qidx] != RT_PORT_LCORE_UNASSIGNED)
+                    continue;
+                rt_lcore_id_t n_lcore =
+                    find_next_lcore_index(lcore_next_idx[socket], socket);
+                pi->rxq_lcore[qidx] = n_lcore;
+                lcore_next_idx[socket] = n_lcore + 1;
+            }
+            pi->rx_lcore = pi->rxq_lcore[0];
+            continue;
+        }
         /* Skip if the port is already assigned */
         rt_lcore_id_t c_lcore = rt_port_query_lcore(prtidx, direction);
         if (c_lcore != RT_PORT_LCORE_UNASSIGNED)
             continue;
-        rt_lcore_id_t n_lcore = find_next_lcore_index(lcore_next_idx);
+        rt_lcore_id_t n_lcore =
+            find_next_lcore_index(lcore_next_idx[socket], socket);
         rt_port_assign_thread(prtidx, direction, n_lcore);
-        lcore_next_idx = n_lcore + 1;
+        lcore_next_idx[socket] = n_lcore + 1;
     }
 }
 
@@ -97,11 +136,13 @@ rt_queue_list_t *
 create_thread_rx_queue_list (rt_lcore_id_t lcore)
 {
     int qcount = 0;
-    /* Count the number of ports needed */
+    int qidx;
+    /* Count the number of queues needed */
     FOREACH_PORT(prtidx) {
         rt_port_info_t *pi = rt_port_lookup(prtidx);
-        if (pi->rx_lcore == lcore) {
-            qcount++;
+        for (qidx = 0 ; qidx < pi->rx_q_count ; qidx++) {
+            if (pi->rxq_lcore[qidx] == lcore)
+                qcount++;
         }
     }
     size_t size = sizeof(rt_queue_list_t)
@@ -112,10 +153,12 @@ create_thread_rx_queue_list (rt_lcore_id_t lcore)
     rt_queue_t *qp = &qlist->list[0];
     FOREACH_PORT(prtidx) {
         rt_port_info_t *pi = rt_port_lookup(prtidx);
-        if (pi->rx_lcore == lcore) {
-            qp->prtidx = prtidx;
-            qp->queidx = 0; /* Only queue '0' for now */
-            qp++;
+        for (qidx = 0 ; qidx < pi->rx_q_count ; qidx++) {
+            if (pi->rxq_lcore[qidx] == lcore) {
+                qp->prtidx = prtidx;
+                qp->queidx = qidx;
+                qp++;
+            }
         }
     }
     return qlist;
@@ -124,7 +167,7 @@ create_thread_rx_queue_list (rt_lcore_id_t lcore)
 void
 rt_port_log_queue_list (rt_lcore_id_t lcore, const rt_queue_list_t *ql)
 {
-    char ts[128];
+    char ts[512];
     int idx, n = 0;
     n += sprintf(&ts[n], "LCORE %u RX Task List:", lcore);
     for (idx = 0 ; idx < ql->count ; idx++) {
@@ -147,6 +190,20 @@ rt_port_check_lcores (void)
                 return -1;
             }
         }
+        rt_port_info_t *pi = rt_port_lookup(prtidx);
+        int qidx;
+        for (qidx = 0 ; qidx < pi->rx_q_count ; qidx++) {
+            rt_lcore_id_t lcore = pi->rxq_lcore[qidx];
+            if (!rte_lcore_is_enabled(lcore)) {
+                fprintf(stderr, "ERROR: lcore %u is not enabled\n", lcore);
+                return -1;
+            }
+            if ((int) lcore == g.ctrl_lcore) {
+                fprintf(stderr, "ERROR: lcore %u is the control lcore\n",
+                    lcore);
+                return -1;
+            }
+        }
     }
     return 0;
 }
@@ -156,8 +213,13 @@ log_port_lcore_assignment (void)
 {
     FOREACH_PORT(prtidx) {
         rt_port_info_t *pi = rt_port_lookup(prtidx);
-        dbgmsg(CONF, nopkt, "Port %u lcore assignment: RX: %u, TX: %u",
-            prtidx, pi->rx_lcore, pi->tx_lcore);
+        char ts[128];
+        int qidx, n = 0;
+        for (qidx = 0 ; qidx < pi->rx_q_count ; qidx++)
+            n += sprintf(&ts[n], "%s%u", (qidx > 0) ? "+" : "",
+                pi->rxq_lcore[qidx]);
+        dbgmsg(CONF, nopkt, "Port %u lcore assignment: RX: %s, TX: %u",
+            prtidx, ts, pi->tx_lcore);
     }
 }
 
@@ -186,6 +248,8 @@ rt_port_table_init (void)
         pi->rx_q_count = 1;
         pi->tx_q_count = 1;
         pi->rx_lcore = RT_PORT_LCORE_UNASSIGNED;
+        memset(pi->rxq_lcore, RT_PORT_LCORE_UNASSIGNED,
+            sizeof(pi->rxq_lcore));
         pi->tx_lcore = RT_PORT_LCORE_UNASSIGNED;
         pi->rx_desc_cnt = RTE_RX_DESC_DEFAULT;
         pi->tx_desc_cnt = RTE_TX_DESC_DEFAULT;
@@ -42,8 +42,10 @@ typedef struct {
     int                 tx_desc_cnt;
     rt_cnt_idx_t        cntidx;
     rt_dhcp_info_t      dhcpinfo;
-    rt_lcore_id_t       rx_lcore;
+    rt_lcore_id_t       rx_lcore;   /* Same as rxq_lcore[0] */
     rt_lcore_id_t       tx_lcore;
+    /* lcore polling each RX queue */
+    rt_lcore_id_t       rxq_lcore[MAX_RX_QUEUE_PER_PORT];
 } rt_port_info_t;
 
 /* Per-Thread Queue List to process on RX */
@@ -55,6 +57,8 @@ typedef struct {
 #define RT_PORT_F_EXIST         (1 << 0)
 #define RT_PORT_F_PROMISC       (1 << 1)
 #define RT_PORT_F_GRATARP       (1 << 2)
+#define RT_PORT_F_DIRECT_TX     (1 << 3)    /* One TX queue per lcore */
+#define RT_PORT_F_RX_INTR       (1 << 4)    /* RX queue interrupts enabled */
 
 #define RT_PORT_LCORE_UNASSIGNED    (255)
 
@@ -96,7 +100,8 @@ void rt_port_table_init (void);
 
 /* port-setup.c */
 int rt_port_setup (void);
-int rt_port_desc_count (void);
+int rt_port_desc_count (int socket);
+void rt_port_tx_queue_assign (void);
 void rt_check_all_ports_link_status (void);
 
 #endif
@@ -0,0 +1,286 @@
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+
+#include <rte_common.h>
+#include <rte_version.h>
+#include <rte_cycles.h>
+#if RTE_VERSION >= RTE_VERSION_NUM(17,5,0,0)
+#include <rte_pause.h>
+#endif
+#include <rte_lcore.h>
+#include <rte_interrupts.h>
+#include <rte_ethdev.h>
+
+#include "defines.h"
+#include "port.h"
+#include "rcu.h"
+#include "dbgmsg.h"
+#include "slowpath.h"
+#include "power.h"
+
+/* Back-off step of an idle iteration */
+#define RT_PWR_STEP_NONE    0
+#define RT_PWR_STEP_PAUSE   1
+#define RT_PWR_STEP_SLEEP   2
+#define RT_PWR_STEP_INTR    3
+
+typedef struct {
+    uint64_t idle_since;    /* TSC of the last busy iteration */
+    int step;               /* Back-off step of the last iteration */
+    uint64_t step_cycles;   /* ... and how long it took */
+    int intr_woken;         /* RT_PWR_STEP_INTR ended by an interrupt */
+    /* RX queues set up for interrupts (a copy of the queue list) */
+    int reg_cnt;
+    int reg_added;          /* Queues actually added to the epoll set */
+    int no_intr;            /* Interrupt setup failed for these queues */
+    rt_queue_t reg[RT_PWR_MAX_QUEUES];
+    /* Written to by threads that queue packets for this lcore */
+    int wake_fd;
+    struct rte_epoll_event wake_ev;
+    /* Statistics */
+    uint64_t sleep_cycles;
+    uint64_t intr_cycles;
+    uint64_t wakes;         /* Back-off steps followed by traffic */
+    uint64_t intr_wakes;    /* ... woken by an interrupt */
+    uint64_t lat_cycles;    /* Sum and max of the other steps' durations */
+    uint64_t lat_max;
+} __rte_cache_aligned rt_power_lcore_t;
+
+static rt_power_lcore_t rt_power_lcore[RTE_MAX_LCORE];
+volatile uint8_t rt_power_asleep[RTE_MAX_LCORE];
+static uint64_t rt_power_spin_tsc;
+static uint64_t rt_power_sleep_tsc;
+static uint64_t rt_power_intr_tsc;
+static uint64_t rt_power_print_tsc;
+
+void
+rt_power_init (void)
+{
+    uint64_t us = (rte_get_tsc_hz() + US_PER_S - 1) / US_PER_S;
+    rt_power_spin_tsc = us * RT_PWR_SPIN_US;
+    rt_power_sleep_tsc = us * RT_PWR_SLEEP_AFTER_US;
+    rt_power_intr_tsc = us * 1000 * g.power_intr_ms;
+    if (g.power && (g.power_intr_ms > 0)
+            && (rt_power_intr_tsc < rt_power_sleep_tsc))
+        rt_power_intr_tsc = rt_power_sleep_tsc;
+    rt_power_print_tsc = rte_rdtsc();
+    unsigned lcore;
+    for (lcore = 0 ; lcore < RTE_MAX_LCORE ; lcore++)
+        rt_power_lcore[lcore].wake_fd = -1;
+}
+
+void
+rt_power_wake_up (unsigned lcore)
+{
+    uint64_t one = 1;
+    if (write(rt_power_lcore[lcore].wake_fd, &one, sizeof(one)) < 0)
+        dbgmsg(DEBUG, nopkt, "Cannot wake lcore %u", lcore);
+}
+
+/* The eventfd other threads wake the lcore with (rt_power_wake_up) */
+static int
+rt_power_wake_setup (rt_power_lcore_t *ps, unsigned lcore)
+{
+    if (ps->wake_fd >= 0)
+        return 0;
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    ps->wake_ev.epdata.event = EPOLLIN;
+    ps->wake_ev.epdata.data = NULL;
+    ps->wake_ev.epdata.cb_fun = NULL;
+    if (rte_epoll_ctl(RTE_EPOLL_PER_THREAD, EPOLL_CTL_ADD, fd,
+            &ps->wake_ev) < 0) {
+        close(fd);
+        return -1;
+    }
+    ps->wake_fd = fd;
+    return 0;
+}
+
+/*
+ * Register the RX queues of 'ql' with the calling thread's epoll set,
+ * after dropping those of a previous list (see --rx-balance). Returns
+ * -1 if the lcore cannot wait for interrupts.
+ */
+static int
+rt_power_intr_setup (rt_power_lcore_t *ps, unsigned lcore,
+    const rt_queue_list_t *ql)
+{
+    int idx;
+    if (ql->count > RT_PWR_MAX_QUEUES)
+        return -1;
+    if (rt_power_wake_setup(ps, lcore) < 0) {
+        if (!ps->no_intr)
+            dbgmsg(WARN, nopkt, "lcore %u: no wakeup eventfd", lcore);
+        ps->no_intr = 1;
+        return -1;
+    }
+    size_t size = ql->count * sizeof(rt_queue_t);
+    if ((ql->count == ps->reg_cnt) && (memcmp(ql->list, ps->reg, size) == 0))
+        return ps->no_intr ? -1 : 0;
+
+    for (idx = 0 ; idx < ps->reg_added ; idx++) {
+        rte_eth_dev_rx_intr_ctl_q(ps->reg[idx].prtidx, ps->reg[idx].queidx,
+            RTE_EPOLL_PER_THREAD, RTE_INTR_EVENT_DEL, NULL);
+    }
+    ps->reg_cnt = ql->count;
+    ps->reg_added = 0;
+    ps->no_intr = 0;
+    memcpy(ps->reg, ql->list, size);
+
+    for (idx = 0 ; idx < ps->reg_cnt ; idx++) {
+        const rt_queue_t *qp = &ps->reg[idx];
+        int rc = -1;
+        if (rt_port_lookup(qp->prtidx)->flags & RT_PORT_F_RX_INTR) {
+            rc = rte_eth_dev_rx_intr_ctl_q(qp->prtidx, qp->queidx,
+                RTE_EPOLL_PER_THREAD, RTE_INTR_EVENT_ADD, NULL);
+        }
+        if (rc < 0) {
+            dbgmsg(WARN, nopkt, "lcore %u: no RX interrupt for p%u:q%u,"
+                " sleeping in short steps instead", lcore,
+                qp->prtidx, qp->queidx);
+            ps->no_intr = 1;
+            return -1;
+        }
+        ps->reg_added++;
+    }
+    return 0;
+}
+
+/*
+ * Wait for any of the registered RX queues to receive a packet, or
+ * for another thread to queue packets for one of our TX rings (or,
+ * on the control lcore, to punt packets). A
+ * packet received between the last poll and enabling interrupts
+ * raises none, and waits for the timeout. Returns 1 if woken up.
+ */
+static int
+rt_power_intr_wait (rt_power_lcore_t *ps, unsigned lcore,
+    tx_queue_set_t *qs, tx_ring_set_t *trs)
+{
+    struct rte_epoll_event event[RT_PWR_MAX_QUEUES + 1];
+    int idx, n = 0;
+    for (idx = 0 ; idx < ps->reg_added ; idx++)
+        rte_eth_dev_rx_intr_enable(ps->reg[idx].prtidx, ps->reg[idx].queidx);
+    /* Pairs with the barrier in tx_queue_flush() */
+    rt_power_asleep[lcore] = 1;
+    rte_smp_mb();
+    if (!tx_pending(qs, trs) && !rt_punt_pending(lcore)) {
+        rt_rcu_offline(lcore);
+        n = rte_epoll_wait(RTE_EPOLL_PER_THREAD, event, RT_PWR_MAX_QUEUES + 1,
+            RT_PWR_INTR_TIMEOUT_MS);
+        rt_rcu_online(lcore);
+    }
+    rt_power_asleep[lcore] = 0;
+    if (n > 0) {
+        uint64_t cnt;
+        if (read(ps->wake_fd, &cnt, sizeof(cnt)) < 0)
+            cnt = 0;
+    }
+    for (idx = 0 ; idx < ps->reg_added ; idx++)
+        rte_eth_dev_rx_intr_disable(ps->reg[idx].prtidx, ps->reg[idx].queidx);
+    return n > 0;
+}
+
+/*
+ * End of a main loop iteration of 'lcore', which received 'rxcnt'
+ * packets. Backs off if the lcore has been idle (nothing received,
+ * nothing left to send) long enough. Called with no references held;
+ * 'ql' is not used after sleeping.
+ */
+void
+rt_power_poll (unsigned lcore, const rt_queue_list_t *ql,
+    tx_queue_set_t *qs, tx_ring_set_t *trs, int rxcnt, uint64_t now)
+{
+    rt_power_lcore_t *ps = &rt_power_lcore[lcore];
+    int busy = (rxcnt > 0) || tx_pending(qs, trs);
+
+    if (busy || unlikely(ps->idle_since == 0)) {
+        if (ps->step != RT_PWR_STEP_NONE) {
+            ps->wakes++;
+            if ((ps->step == RT_PWR_STEP_INTR) && ps->intr_woken) {
+                ps->intr_wakes++;
+            } else {
+                ps->lat_cycles += ps->step_cycles;
+                if (ps->step_cycles > ps->lat_max)
+                    ps->lat_max = ps->step_cycles;
+            }
+            ps->step = RT_PWR_STEP_NONE;
+        }
+        ps->idle_since = now;
+        return;
+    }
+
+    uint64_t idle = now - ps->idle_since;
+    if (idle < rt_power_spin_tsc)
+        return;
+
+    int idx;
+    uint64_t start = rte_rdtsc();
+    if (idle < rt_power_sleep_tsc) {
+        for (idx = 0 ; idx < RT_PWR_PAUSES ; idx++)
+            rte_pause();
+        ps->step = RT_PWR_STEP_PAUSE;
+    } else if ((rt_power_intr_tsc == 0) || (idle < rt_power_intr_tsc)
+            || (rt_power_intr_setup(ps, lcore, ql) < 0)) {
+        rt_rcu_offline(lcore);
+        usleep(RT_PWR_SLEEP_US);
+        rt_rcu_online(lcore);
+        ps->step = RT_PWR_STEP_SLEEP;
+        ps->sleep_cycles += rte_rdtsc() - start;
+    } else {
+        ps->intr_woken = rt_power_intr_wait(ps, lcore, qs, trs);
+        ps->step = RT_PWR_STEP_INTR;
+        ps->intr_cycles += rte_rdtsc() - start;
+    }
+    ps->step_cycles = rte_rdtsc() - start;
+}
+
+/*
+ * Per lcore: share of the time spent sleeping and waiting for
+ * interrupts (the CPU time saved), and the wakeups that found
+ * traffic. Wake latency is the length of the step before such a
+ * wakeup (pause, sleep, or interrupt wait that timed out), the most
+ * it delayed the first packet; interrupt wakeups are counted apart.
+ */
+void
+rt_power_print_stats (FILE *fd)
+{
+    static uint64_t prev[RTE_MAX_LCORE][5];
+    if (!g.power)
+        return;
+    uint64_t now = rte_rdtsc();
+    double elapsed = (double) (now - rt_power_print_tsc);
+    double us = (double) rte_get_tsc_hz() / US_PER_S;
+    unsigned lcore_id;
+    fprintf(fd, "Power:\n");
+    RTE_LCORE_FOREACH(lcore_id) {
+        const volatile rt_power_lcore_t *ps = &rt_power_lcore[lcore_id];
+        uint64_t cur[5] = { ps->sleep_cycles, ps->intr_cycles, ps->wakes,
+            ps->intr_wakes, ps->lat_cycles };
+        uint64_t d[5];
+        int idx;
+        for (idx = 0 ; idx < 5 ; idx++) {
+            d[idx] = cur[idx] - prev[lcore_id][idx];
+            prev[lcore_id][idx] = cur[idx];
+        }
+        uint64_t lat_wakes = d[2] - d[3];
+        fprintf(fd, "  lcore %2u: idle %5.1f%% (sleep %5.1f%%, intr %5.1f%%)"
+            "  wakeups %" PRIu64 " (intr %" PRIu64 ")"
+            "  wake latency avg %.1f max %.1f us\n",
+            lcore_id,
+            100.0 * (double) (d[0] + d[1]) / elapsed,
+            100.0 * (double) d[0] / elapsed,
+            100.0 * (double) d[1] / elapsed,
+            d[2], d[3],
+            (lat_wakes > 0) ? (double) d[4] / (double) lat_wakes / us : 0.0,
+            (double) ps->lat_max / us);
+    }
+    rt_power_print_tsc = now;
+    fflush(fd);
+}
@@ -0,0 +1,42 @@
+#ifndef __RT_POWER_H__
+#define __RT_POWER_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "port.h"
+#include "rings.h"
+
+/*
+ * Adaptive polling (--power)
+ *
+ * An lcore that has had nothing to do (no packets received, nothing
+ * waiting to be sent) backs off in steps, by how long it has been
+ * idle:
+ *
+ *   < RT_PWR_SPIN_US           busy polling as usual
+ *   < RT_PWR_SLEEP_AFTER_US    rte_pause() between polls
+ *   < --power-intr-ms          sleep RT_PWR_SLEEP_US between polls
+ *   after that                 wait for an RX interrupt, at most
+ *                              RT_PWR_INTR_TIMEOUT_MS
+ *
+ * Interrupts are only used if all RX queues of the lcore support
+ * them; otherwise the lcore keeps sleeping in short steps. Threads
+ * that put packets into the TX ring of a port whose TX lcore waits
+ * for interrupts wake it through an eventfd in the same epoll set
+ * (see tx_queue_flush). While it sleeps the lcore is offline for RCU.
+ */
+
+#define RT_PWR_SPIN_US          100
+#define RT_PWR_SLEEP_AFTER_US   1000
+#define RT_PWR_SLEEP_US         50
+#define RT_PWR_PAUSES           64
+#define RT_PWR_INTR_TIMEOUT_MS  10
+#define RT_PWR_MAX_QUEUES       MAX_RX_QUEUE_PER_LCORE
+
+void rt_power_init (void);
+void rt_power_poll (unsigned lcore, const rt_queue_list_t *ql,
+    tx_queue_set_t *qs, tx_ring_set_t *trs, int rxcnt, uint64_t now);
+void rt_power_print_stats (FILE *fd);
+
+#endif
@@ -0,0 +1,106 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <rte_per_lcore.h>
+
+#include "rcu.h"
+
+volatile uint64_t rt_rcu_epoch;
+rt_rcu_lcore_t rt_rcu_lcore[RT_RCU_SLOTS];
+
+/* Thread-private list of retired objects */
+typedef struct rt_rcu_defer_s {
+    struct rt_rcu_defer_s *next;
+    uint64_t epoch;
+    rt_rcu_fn_t fn;
+    void *arg;
+} rt_rcu_defer_t;
+
+static RTE_DEFINE_PER_LCORE(rt_rcu_defer_t *, _rcu_defer);
+
+/*
+ * Going online must be visible before the lcore reads any table
+ * (store-load order, which a release store does not give), otherwise
+ * a reclaimer may still take the slot as offline and free an object
+ * the lcore has just picked up.
+ */
+void
+rt_rcu_online (unsigned slot)
+{
+    uint64_t epoch = __atomic_load_n(&rt_rcu_epoch, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&rt_rcu_lcore[slot].epoch, epoch, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void
+rt_rcu_offline (unsigned slot)
+{
+    __atomic_store_n(&rt_rcu_lcore[slot].epoch, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Call 'fn(arg)' once all readers are done with the object. The list
+ * is private to the calling thread, so no locking is needed.
+ */
+void
+rt_rcu_defer (rt_rcu_fn_t fn, void *arg)
+{
+    rt_rcu_defer_t *dp = (rt_rcu_defer_t *) malloc(sizeof(rt_rcu_defer_t));
+    assert(dp != NULL);
+    dp->fn = fn;
+    dp->arg = arg;
+    dp->epoch = __atomic_add_fetch(&rt_rcu_epoch, 1, __ATOMIC_SEQ_CST);
+    dp->next = RTE_PER_LCORE(_rcu_defer);
+    RTE_PER_LCORE(_rcu_defer) = dp;
+}
+
+/*
+ * Queue an object for release once all readers are done with it
+ */
+void
+rt_rcu_defer_free (void *ptr)
+{
+    if (ptr != NULL)
+        rt_rcu_defer(free, ptr);
+}
+
+/*
+ * Release all retired objects of the calling thread that no online
+ * lcore can still reference.
+ */
+void
+rt_rcu_reclaim (void)
+{
+    rt_rcu_defer_t **dpp = &RTE_PER_LCORE(_rcu_defer);
+    if (*dpp == NULL)
+        return;
+
+    uint64_t safe = UINT64_MAX;
+    int slot;
+    /* Pairs with the fence in rt_rcu_online() */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (slot = 0 ; slot < RT_RCU_SLOTS ; slot++) {
+        uint64_t epoch = __atomic_load_n(&rt_rcu_lcore[slot].epoch,
+            __ATOMIC_ACQUIRE);
+        if ((epoch != 0) && (epoch < safe))
+            safe = epoch;
+    }
+
+    while (*dpp != NULL) {
+        rt_rcu_defer_t *dp = *dpp;
+        if (dp->epoch <= safe) {
+            *dpp = dp->next;
+            dp->fn(dp->arg);
+            free(dp);
+        } else {
+            dpp = &dp->next;
+        }
+    }
+}
+
+void
+rt_rcu_init (void)
+{
+    memset(rt_rcu_lcore, 0, sizeof(rt_rcu_lcore));
+    rt_rcu_epoch = 1;
+}
@@ -0,0 +1,59 @@
+#ifndef __RT_RCU_H__
+#define __RT_RCU_H__
+
+#include <stdint.h>
+
+#include <rte_common.h>
+#include <rte_lcore.h>
+
+#include "defines.h"
+
+/*
+ * Quiescent-State-Based Reclamation (QSBR)
+ *
+ * Forwarding lcores read shared tables without taking any lock.
+ * A writer replaces or unlinks an object and hands the old one to
+ * rt_rcu_defer_free(). The object is released once every online
+ * lcore has passed a quiescent state (a point where it holds no
+ * table references) after the object was retired.
+ */
+
+typedef struct {
+    /* Last global epoch observed in a quiescent state (0: offline) */
+    volatile uint64_t epoch;
+} __rte_cache_aligned rt_rcu_lcore_t;
+
+/* One slot per lcore plus one for the housekeeping thread */
+#define RT_RCU_HK_SLOT  RTE_MAX_LCORE
+#define RT_RCU_SLOTS    (RTE_MAX_LCORE + 1)
+
+extern volatile uint64_t rt_rcu_epoch;
+extern rt_rcu_lcore_t rt_rcu_lcore[RT_RCU_SLOTS];
+
+#define rt_rcu_dereference(p) \
+    __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+
+#define rt_rcu_assign_pointer(p, v) \
+    __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+/*
+ * Report a quiescent state. Called by each online lcore once per
+ * main-loop iteration, outside of any packet processing.
+ */
+static inline void
+rt_rcu_quiescent (unsigned slot)
+{
+    __atomic_store_n(&rt_rcu_lcore[slot].epoch, rt_rcu_epoch,
+        __ATOMIC_RELEASE);
+}
+
+void rt_rcu_online (unsigned slot);
+void rt_rcu_offline (unsigned slot);
+typedef void (*rt_rcu_fn_t)(void *arg);
+
+void rt_rcu_defer (rt_rcu_fn_t fn, void *arg);
+void rt_rcu_defer_free (void *ptr);
+void rt_rcu_reclaim (void);
+void rt_rcu_init (void);
+
+#endif
@@ -1,6 +1,83 @@
 #include "rings.h"
 #include "dbgmsg.h"
 
+/**********************************************************************/
+/*  TX Hold Buffers */
+
+/*
+ * Retry the packets held for a TX queue. If they have been held for
+ * longer than the hold time, whatever is left is dropped. Returns the
+ * number of packets still held.
+ */
+static int
+tx_hold_retry (tx_hold_t *hp, int prtidx, uint16_t txq, uint64_t now)
+{
+    if (hp->cnt == 0)
+        return 0;
+    rt_port_stats_t *ps = rt_port_stats(prtidx);
+    int sndcnt = rte_eth_tx_burst(prtidx, txq, hp->mbufs, hp->cnt);
+    if (sndcnt > 0) {
+        ps->tx += sndcnt;
+        ps->tx_bursts++;
+        ps->tx_retried += sndcnt;
+        hp->cnt -= sndcnt;
+        memmove(hp->mbufs, &hp->mbufs[sndcnt], hp->cnt * sizeof(void *));
+    }
+    if ((hp->cnt > 0) && (now - hp->since >= g.tx_hold_tsc)) {
+        dbgmsg(DEBUG, nopkt, "TX HOLD TIMEOUT (Prt %u, Queue %u, Disc %u)",
+            prtidx, txq, hp->cnt);
+        rt_cap_qfull(hp->mbufs, hp->cnt);
+        pktmbuf_free_bulk(hp->mbufs, hp->cnt);
+        ps->disc[RT_DISC_QFULL] += hp->cnt;
+        ps->tx_hold_drop += hp->cnt;
+        hp->cnt = 0;
+    }
+    return hp->cnt;
+}
+
+/*
+ * Hold packets the TX queue did not accept. What does not fit (or
+ * everything, if holding is disabled) is dropped.
+ */
+static void
+tx_hold_add (tx_hold_t *hp, int prtidx, struct rte_mbuf **mbufs, int count,
+    uint64_t now)
+{
+    int n = (g.tx_hold_tsc > 0) ? TX_HOLD_SIZE - hp->cnt : 0;
+    if (n > count)
+        n = count;
+    if ((hp->cnt == 0) && (n > 0))
+        hp->since = now;
+    memcpy(&hp->mbufs[hp->cnt], mbufs, n * sizeof(void *));
+    hp->cnt += n;
+    if (unlikely(n < count)) {
+        dbgmsg(DEBUG, nopkt, "TX FULL (Prt %u, Disc %u)",
+            prtidx, count - n);
+        rt_cap_qfull(&mbufs[n], count - n);
+        pktmbuf_free_bulk(&mbufs[n], count - n);
+        rt_port_stats(prtidx)->disc[RT_DISC_QFULL] += count - n;
+    }
+}
+
+/*
+ * Transmit on a TX queue owned by the calling lcore. Held packets go
+ * first; new packets wait behind them so that order is kept.
+ */
+void
+tx_queue_send (tx_hold_t *hp, int prtidx, uint16_t txq,
+    struct rte_mbuf **mbufs, int count, uint64_t now)
+{
+    int sndcnt = 0;
+    if (tx_hold_retry(hp, prtidx, txq, now) == 0) {
+        sndcnt = rte_eth_tx_burst(prtidx, txq, mbufs, count);
+        rt_port_stats(prtidx)->tx += sndcnt;
+        if (likely(sndcnt > 0))
+            rt_port_stats(prtidx)->tx_bursts++;
+    }
+    if (unlikely(sndcnt < count))
+        tx_hold_add(hp, prtidx, &mbufs[sndcnt], count - sndcnt, now);
+}
+
 /**********************************************************************/
 /*  Queue Set */
 
@@ -17,13 +94,85 @@ tx_queue_flush_all (tx_queue_set_t *qsp)
     }
 }
 
+/*
+ * End of a main loop iteration: flush the thread-private queues as
+ * the TX drain policy (--tx-drain) says. Full batches never get here,
+ * tx_pkt_enqueue() sends them right away. 'idle' tells that the
+ * iteration received no packets.
+ */
+void
+tx_queue_drain (tx_queue_set_t *qsp, int idle)
+{
+    int prtcnt = qsp->prtcnt;
+    int prtidx;
+    for (prtidx = 0 ; prtidx < prtcnt ; prtidx++) {
+        int pktcnt = qsp->pktcnt[prtidx];
+        if (pktcnt == 0) {
+            if (unlikely(qsp->hold[prtidx].cnt > 0))
+                tx_hold_retry(&qsp->hold[prtidx], prtidx, qsp->txq[prtidx],
+                    qsp->now);
+            continue;
+        }
+        int reason;
+        if (g.tx_drain == RT_TX_DRAIN_LOOP)
+            reason = RT_TXF_LOOP;
+        else if (qsp->now - qsp->since[prtidx] >= g.tx_drain_tsc)
+            reason = RT_TXF_TIMEOUT;
+        else if (idle && (g.tx_drain == RT_TX_DRAIN_IDLE))
+            reason = RT_TXF_IDLE;
+        else
+            continue;
+        rt_port_stats(prtidx)->tx_flush[reason]++;
+        tx_queue_flush(qsp, prtidx, pktcnt);
+    }
+}
+
+/*
+ * Whether the thread has packets left to send: queued or held in its
+ * queue set, held after a full TX queue or waiting in one of the TX
+ * rings it drains.
+ */
+int
+tx_pending (const tx_queue_set_t *qsp, const tx_ring_set_t *trs)
+{
+    int idx;
+    for (idx = 0 ; idx < qsp->prtcnt ; idx++) {
+        if ((qsp->pktcnt[idx] > 0) || (qsp->hold[idx].cnt > 0))
+            return 1;
+    }
+    for (idx = 0 ; idx < trs->count ; idx++) {
+        const tx_ring_info_t *ri = &trs->ri[idx];
+        if ((ri->hold.cnt > 0) || !rte_ring_empty(ri->ring))
+            return 1;
+    }
+    return 0;
+}
+
 RTE_DEFINE_PER_LCORE(tx_queue_set_t *, _queue_set);
+RTE_DEFINE_PER_LCORE(pktmbuf_free_batch_t, _free_batch);
+
+/*
+ * TX queue of the calling lcore on a port with per-lcore TX queues
+ * (see rt_port_tx_queue_assign), TX_QUEUE_RING otherwise. Non-EAL
+ * threads always go through the ring.
+ */
+static uint16_t
+tx_queue_own (int prtidx)
+{
+    unsigned lcore = rte_lcore_id();
+    if (!(rt_port_lookup(prtidx)->flags & RT_PORT_F_DIRECT_TX)
+            || (lcore >= RTE_MAX_LCORE))
+        return TX_QUEUE_RING;
+    return rte_lcore_index(lcore);
+}
 
 /*
  * With information from the global ring set, create a
  * thread-private queue-set. This queue-set has one simple
  * FIFO per output port and will get flushed at the end of
  * each main-loop iteration by tx_queue_flush_all().
+ * Packets for a port where the thread owns a TX queue are
+ * transmitted directly, otherwise they go to the port's ring.
  */
 tx_queue_set_t *
 create_queue_set (const tx_ring_set_t *grs)
@@ -36,15 +185,25 @@ create_queue_set (const tx_ring_set_t *grs)
     memset(qsp, 0, size);
     qsp->ring   = (struct rte_ring **) malloc(prtcnt * sizeof(void *));
     qsp->pktcnt = (uint8_t *) malloc(prtcnt * sizeof(uint8_t));
+    qsp->txq    = (uint16_t *) malloc(prtcnt * sizeof(uint16_t));
+    qsp->since  = (uint64_t *) malloc(prtcnt * sizeof(uint64_t));
+    qsp->hold   = (tx_hold_t *) malloc(prtcnt * sizeof(tx_hold_t));
     qsp->mbufs  = (void *) malloc(bufcnt * sizeof(void *));
     assert(qsp->ring != NULL);
+    assert(qsp->txq != NULL);
+    assert(qsp->since != NULL);
+    assert(qsp->hold != NULL);
     assert(qsp->pktcnt != NULL);
     assert(qsp->mbufs != NULL);
     uint32_t prtidx;
     for (prtidx = 0 ; prtidx < prtcnt ; prtidx++) {
         qsp->pktcnt[prtidx] = 0;
         qsp->ring[prtidx] = grs->ri[prtidx].ring;
+        qsp->txq[prtidx] = tx_queue_own(grs->ri[prtidx].prtidx);
+        qsp->since[prtidx] = 0;
+        qsp->hold[prtidx].cnt = 0;
     }
+    qsp->now = 0;
     qsp->prtcnt = grs->count;
 
     /* Save queue-set pointer to thread-private variable */
@@ -115,16 +274,23 @@ create_thread_ring_set (tx_ring_set_t *grs)
             tx_ring_info_t *ri = &trs->ri[thridx++];
             ri->ring = grs->ri[prtidx].ring;
             ri->prtidx = grs->ri[prtidx].prtidx;
+            /* With per-lcore TX queues, drain into our own */
+            ri->txq = tx_queue_own(ri->prtidx);
+            if (ri->txq == TX_QUEUE_RING)
+                ri->txq = 0;
         }
     }
     return trs;
 }
 
 /*
- * For all rings in a thread's ring-set, send out all packets
+ * For all rings in a thread's ring-set, send out all packets.
+ * Unless the TX drain policy is 'loop', a ring is only drained once
+ * it holds a full burst, when the lcore is idle, or when the latency
+ * budget has passed since its last drain.
  */
 void
-flush_thread_ring_set (tx_ring_set_t *trs)
+flush_thread_ring_set (tx_ring_set_t *trs, uint64_t now, int idle)
 {
     int cnt = trs->count;
     int idx;
@@ -132,8 +298,17 @@ flush_thread_ring_set (tx_ring_set_t *trs)
     for (idx = 0 ; idx < cnt ; idx++) {
         tx_ring_info_t *ri = &trs->ri[idx];
         struct rte_ring *ring = ri->ring;
+        /* While the NIC is backed up, leave new packets in the ring */
+        if (tx_hold_retry(&ri->hold, ri->prtidx, ri->txq, now) > 0)
+            continue;
         if (rte_ring_empty(ring))
             continue;
+        if ((g.tx_drain != RT_TX_DRAIN_LOOP)
+                && (rte_ring_count(ring) < TX_BURST_SIZE)
+                && !(idle && (g.tx_drain == RT_TX_DRAIN_IDLE))
+                && (now - ri->last < g.tx_drain_tsc))
+            continue;
+        ri->last = now;
         int pktcnt, sndcnt;
         do {
             int prtidx = ri->prtidx;
@@ -143,17 +318,15 @@ flush_thread_ring_set (tx_ring_set_t *trs)
             #else
                 TX_BURST_SIZE);
             #endif
-            sndcnt = rte_eth_tx_burst(prtidx, 0, mbufs, pktcnt);
+            sndcnt = rte_eth_tx_burst(prtidx, ri->txq, mbufs, pktcnt);
+            rt_port_stats(prtidx)->tx += sndcnt;
+            if (likely(sndcnt > 0))
+                rt_port_stats(prtidx)->tx_bursts++;
             if (unlikely(sndcnt < pktcnt)) {
-                dbgmsg(DEBUG, nopkt,
-                    "TX FULL (Prt %u, Disc %u)",
-                    prtidx, sndcnt < pktcnt);
-                pktmbuf_free_bulk(&mbufs[sndcnt], pktcnt - sndcnt);
-                port_statistics[prtidx].disc[RT_DISC_QFULL]
-                    += pktcnt - sndcnt;
+                tx_hold_add(&ri->hold, prtidx, &mbufs[sndcnt],
+                    pktcnt - sndcnt, now);
                 break;
             }
-            port_statistics[prtidx].tx += sndcnt;
         } while (sndcnt == TX_BURST_SIZE);
     }
 }
@@ -13,19 +13,43 @@
 
 #include "defines.h"
 #include "dbgmsg.h"
+#include "capture.h"
 
 /**********************************************************************/
 #define TX_QUEUE_SIZE_SHIFT  (6)
 #define TX_QUEUE_SIZE (1 << TX_QUEUE_SIZE_SHIFT)
 
+/* Queue set entry of a port without a TX queue of its own */
+#define TX_QUEUE_RING 0xffff
+
+/*
+ * Packets a TX queue did not accept, retried on the next loop
+ * iterations for up to --tx-hold-us before they are dropped.
+ */
+#define TX_HOLD_SIZE (2 * TX_QUEUE_SIZE)
+
+typedef struct {
+    uint16_t cnt;
+    uint64_t since;     /* TSC when the oldest packet was held */
+    struct rte_mbuf *mbufs[TX_HOLD_SIZE];
+} tx_hold_t;
+
 typedef struct {
     uint16_t prtcnt;
     uint8_t size;
     uint8_t *pktcnt;
+    /* Array of own TX queue ids (TX_QUEUE_RING: use the port's ring) */
+    uint16_t *txq;
     /* Array of ring pointers */
     struct rte_ring **ring;
     /* Array of arrays of mbuf pointers */
     struct rte_mbuf **mbufs;
+    /* TSC of the current loop iteration and, per port, of the
+     * iteration that queued the oldest packet (see tx_queue_drain) */
+    uint64_t now;
+    uint64_t *since;
+    /* Per port hold buffer of the own TX queue */
+    tx_hold_t *hold;
 } tx_queue_set_t;
 
 RTE_DECLARE_PER_LCORE(tx_queue_set_t *, _queue_set);
@@ -43,7 +67,10 @@ RTE_DECLARE_PER_LCORE(tx_queue_set_t *, _queue_set);
  */
 typedef struct {
     uint16_t prtidx;
+    uint16_t txq;       /* TX queue the ring is drained into */
     struct rte_ring *ring;
+    uint64_t last;      /* TSC of the last drain */
+    tx_hold_t hold;
 } tx_ring_info_t;
 
 typedef struct {
@@ -60,20 +87,98 @@ tx_queue_port_mbuf (tx_queue_set_t *qp, int prtidx)
     return &qp->mbufs[prtidx << TX_QUEUE_SIZE_SHIFT];
 }
 
+#if RTE_VERSION < RTE_VERSION_NUM(17,5,0,0)
+#define rte_pktmbuf_prefree_seg __rte_pktmbuf_prefree_seg
+#endif
+
+/*
+ * Free mbufs, returning runs of single-segment mbufs from the same
+ * pool with one mempool put.
+ */
 static inline void
 pktmbuf_free_bulk (struct rte_mbuf *list[], unsigned n)
 {
-    unsigned int i;
+#if RTE_VERSION >= RTE_VERSION_NUM(19,11,0,0)
+    rte_pktmbuf_free_bulk(list, n);
+#else
+    void *pend[MAX_PKT_BURST];
+    struct rte_mempool *pool = NULL;
+    unsigned int i, cnt = 0;
     for (i = 0 ; i < n ; i++) {
-        rte_pktmbuf_free(list[i]);
+        struct rte_mbuf *m = list[i];
+        if (unlikely(m->nb_segs != 1)) {
+            rte_pktmbuf_free(m);
+            continue;
+        }
+        /* NULL: still referenced (clone) */
+        m = rte_pktmbuf_prefree_seg(m);
+        if (unlikely(m == NULL))
+            continue;
+        if ((m->pool != pool) || (cnt == MAX_PKT_BURST)) {
+            if (cnt > 0)
+                rte_mempool_put_bulk(pool, pend, cnt);
+            pool = m->pool;
+            cnt = 0;
+        }
+        pend[cnt++] = m;
+    }
+    if (cnt > 0)
+        rte_mempool_put_bulk(pool, pend, cnt);
+#endif
+}
+
+/*
+ * Thread-private batch of discarded mbufs, freed in bulk when full
+ * and at the end of each main loop iteration (pktmbuf_free_flush).
+ */
+typedef struct {
+    unsigned cnt;
+    struct rte_mbuf *mbufs[MAX_PKT_BURST];
+} pktmbuf_free_batch_t;
+
+RTE_DECLARE_PER_LCORE(pktmbuf_free_batch_t, _free_batch);
+
+static inline void
+pktmbuf_free_later (struct rte_mbuf *mbuf)
+{
+    pktmbuf_free_batch_t *fb = &RTE_PER_LCORE(_free_batch);
+    fb->mbufs[fb->cnt++] = mbuf;
+    if (unlikely(fb->cnt == MAX_PKT_BURST)) {
+        pktmbuf_free_bulk(fb->mbufs, fb->cnt);
+        fb->cnt = 0;
+    }
+}
+
+static inline void
+pktmbuf_free_flush (void)
+{
+    pktmbuf_free_batch_t *fb = &RTE_PER_LCORE(_free_batch);
+    if (fb->cnt > 0) {
+        pktmbuf_free_bulk(fb->mbufs, fb->cnt);
+        fb->cnt = 0;
     }
 }
 
+void tx_queue_send (tx_hold_t *hp, int prtidx, uint16_t txq,
+    struct rte_mbuf **mbufs, int count, uint64_t now);
+
+/* Lcores waiting for interrupts, and how to wake them (see power.c) */
+extern volatile uint8_t rt_power_asleep[RTE_MAX_LCORE];
+void rt_power_wake_up (unsigned lcore);
+
 static inline void
 tx_queue_flush (tx_queue_set_t *qp, int prtidx, int count)
 {
-    struct rte_ring *ring = qp->ring[prtidx];
     struct rte_mbuf **mbufs = tx_queue_port_mbuf(qp, prtidx);
+    uint16_t txq = qp->txq[prtidx];
+    if (txq != TX_QUEUE_RING) {
+        /* Own TX queue on this port: transmit directly */
+        tx_queue_send(&qp->hold[prtidx], prtidx, txq, mbufs, count,
+            qp->now);
+        qp->pktcnt[prtidx] = 0;
+        return;
+    }
+    struct rte_ring *ring = qp->ring[prtidx];
     int enqcnt
     #if RTE_VERSION >= RTE_VERSION_NUM(17,2,0,0)
         = rte_ring_enqueue_burst(ring, (void *) mbufs, count, NULL);
@@ -83,10 +188,18 @@ tx_queue_flush (tx_queue_set_t *qp, int prtidx, int count)
     if (unlikely(enqcnt < count)) {
         dbgmsg(DEBUG, nopkt, "Ring FULL (Prt %u, Core %u, Disc %u)",
             prtidx, rte_lcore_id(), count - enqcnt);
+        rt_cap_qfull(&mbufs[enqcnt], count - enqcnt);
         pktmbuf_free_bulk(&mbufs[enqcnt], count - enqcnt);
-        port_statistics[prtidx].disc[RT_DISC_QFULL] += count - enqcnt;
+        rt_port_stats(prtidx)->disc[RT_DISC_QFULL] += count - enqcnt;
     }
     qp->pktcnt[prtidx] = 0;
+    /* The ring raises no interrupt for a TX lcore that waits for one */
+    if (unlikely(g.power) && (enqcnt > 0)) {
+        unsigned lcore = rt_port_lookup(prtidx)->tx_lcore;
+        rte_smp_mb();
+        if (rt_power_asleep[lcore])
+            rt_power_wake_up(lcore);
+    }
 }
 
 /*
@@ -102,7 +215,10 @@ tx_pkt_enqueue (int prtidx, struct rte_mbuf *mbuf)
     int pos = qsp->pktcnt[prtidx];
     int mbufidx = (prtidx << TX_QUEUE_SIZE_SHIFT) + pos;
     qsp->mbufs[mbufidx] = mbuf;
+    if (pos == 0)
+        qsp->since[prtidx] = qsp->now;
     if (unlikely(pos == (TX_QUEUE_SIZE - 1))) {
+        rt_port_stats(prtidx)->tx_flush[RT_TXF_FULL]++;
         tx_queue_flush(qsp, prtidx, TX_QUEUE_SIZE);
     } else {
         qsp->pktcnt[prtidx] = pos + 1;
@@ -113,8 +229,10 @@ tx_pkt_enqueue (int prtidx, struct rte_mbuf *mbuf)
 
 tx_queue_set_t *create_queue_set (const tx_ring_set_t *grs);
 void tx_queue_flush_all (tx_queue_set_t *qsp);
+void tx_queue_drain (tx_queue_set_t *qsp, int idle);
+int tx_pending (const tx_queue_set_t *qsp, const tx_ring_set_t *trs);
 
-void flush_thread_ring_set (tx_ring_set_t *trs);
+void flush_thread_ring_set (tx_ring_set_t *trs, uint64_t now, int idle);
 
 tx_ring_info_t *ring_set_find_port (tx_ring_set_t *grs, int prtidx);
 void global_ring_set_thread_assign (tx_ring_set_t *grs,
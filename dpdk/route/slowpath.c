@@ -0,0 +1,159 @@
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <rte_common.h>
+#include <rte_version.h>
+#include <rte_cycles.h>
+#include <rte_debug.h>
+#include <rte_lcore.h>
+#include <rte_ring.h>
+#include <rte_prefetch.h>
+
+#include "defines.h"
+#include "stats.h"
+#include "numa.h"
+#include "rings.h"
+#include "functions.h"
+#include "dbgmsg.h"
+#include "slowpath.h"
+
+rt_punt_lcore_t rt_punt_lcore[RTE_MAX_LCORE];
+struct rte_ring *rt_punt_ring = NULL;
+
+/* Punt rate limit: TSC cycles per token, 0: no limit */
+static uint64_t rt_punt_tsc;
+
+void
+rt_punt_init (void)
+{
+    if (g.ctrl_lcore < 0)
+        return;
+    if (!rte_lcore_is_enabled(g.ctrl_lcore) || (rte_lcore_count() < 2)) {
+        rte_exit(EXIT_FAILURE, "Control lcore %d is not enabled"
+            " or the only lcore\n", g.ctrl_lcore);
+    }
+    rt_punt_ring = rte_ring_create("punt_ring", RT_PUNT_RING_SIZE,
+        rt_numa_lcore_socket(g.ctrl_lcore), RING_F_SC_DEQ);
+    if (rt_punt_ring == NULL)
+        rte_exit(EXIT_FAILURE, "Cannot create punt ring\n");
+    if (g.punt_rate > 0)
+        rt_punt_tsc = max(rte_get_tsc_hz() / g.punt_rate, 1);
+    dbgmsg(CONF, nopkt, "Slow path on lcore %d, punt rate %u/s per lcore",
+        g.ctrl_lcore, g.punt_rate);
+}
+
+/*
+ * Take one token, refilling the bucket from the time that has passed.
+ * Returns 0 if the lcore has used up its rate.
+ */
+static inline int
+rt_punt_take_token (rt_punt_lcore_t *pl)
+{
+    if (rt_punt_tsc == 0)
+        return 1;
+    if (pl->tokens == 0) {
+        uint64_t now = rte_rdtsc();
+        uint64_t n = (now - pl->last) / rt_punt_tsc;
+        if (n == 0)
+            return 0;
+        if (n >= RT_PUNT_BURST) {
+            pl->tokens = RT_PUNT_BURST;
+            pl->last = now;
+        } else {
+            pl->tokens = n;
+            pl->last += n * rt_punt_tsc;
+        }
+    }
+    pl->tokens--;
+    return 1;
+}
+
+/*
+ * Hand a packet to the control lcore. Called by forwarding lcores;
+ * the packet goes out with the next rt_punt_flush().
+ */
+void
+rt_punt (rt_pkt_t pkt)
+{
+    rt_punt_lcore_t *pl = &rt_punt_lcore[rte_lcore_id()];
+    if (!rt_punt_take_token(pl)) {
+        rt_lcore_stats_self()->punt_limited++;
+        rt_pkt_discard(pkt, RT_DISC_DROP);
+        return;
+    }
+    pkt.mbuf->port = pkt.pi->idx;
+    pl->mbufs[pl->cnt++] = pkt.mbuf;
+    if (unlikely(pl->cnt == RT_PUNT_BURST))
+        rt_punt_flush_batch(pl);
+}
+
+void
+rt_punt_flush_batch (rt_punt_lcore_t *pl)
+{
+    rt_lcore_stats_t *ls = rt_lcore_stats_self();
+    unsigned cnt = pl->cnt;
+    unsigned enqcnt
+    #if RTE_VERSION >= RTE_VERSION_NUM(17,2,0,0)
+        = rte_ring_mp_enqueue_burst(rt_punt_ring, (void *) pl->mbufs, cnt,
+            NULL);
+    #else
+        = rte_ring_mp_enqueue_burst(rt_punt_ring, (void *) pl->mbufs, cnt);
+    #endif
+    ls->punted += enqcnt;
+    if (unlikely(enqcnt < cnt)) {
+        unsigned idx;
+        for (idx = enqcnt ; idx < cnt ; idx++)
+            ls->port[pl->mbufs[idx]->port].disc[RT_DISC_QFULL]++;
+        ls->punt_full += cnt - enqcnt;
+        rt_cap_qfull(&pl->mbufs[enqcnt], cnt - enqcnt);
+        pktmbuf_free_bulk(&pl->mbufs[enqcnt], cnt - enqcnt);
+    }
+    pl->cnt = 0;
+    /* The ring raises no interrupt for a control lcore waiting for one */
+    if (unlikely(g.power) && (enqcnt > 0)) {
+        rte_smp_mb();
+        if (rt_power_asleep[g.ctrl_lcore])
+            rt_power_wake_up(g.ctrl_lcore);
+    }
+}
+
+/*
+ * Control lcore: run the slow path for a burst of punted packets.
+ * Returns the number of packets processed.
+ */
+int
+rt_punt_process (void)
+{
+    struct rte_mbuf *mbufs[RT_PUNT_BURST];
+    int cnt, idx;
+    cnt = rte_ring_sc_dequeue_burst(rt_punt_ring, (void **) mbufs,
+    #if RTE_VERSION >= RTE_VERSION_NUM(17,2,0,0)
+        RT_PUNT_BURST, NULL);
+    #else
+        RT_PUNT_BURST);
+    #endif
+    for (idx = 0 ; idx < cnt ; idx++)
+        rte_prefetch0(rte_pktmbuf_mtod(mbufs[idx], void *));
+    for (idx = 0 ; idx < cnt ; idx++)
+        rt_pkt_punt_process(mbufs[idx]);
+    return cnt;
+}
+
+void
+rt_punt_print_stats (FILE *fd)
+{
+    uint64_t punted = 0, limited = 0, full = 0;
+    unsigned slot;
+    if (g.ctrl_lcore < 0)
+        return;
+    for (slot = 0 ; slot < RT_STATS_SLOTS ; slot++) {
+        punted += rt_lcore_stats[slot].punted;
+        limited += rt_lcore_stats[slot].punt_limited;
+        full += rt_lcore_stats[slot].punt_full;
+    }
+    fprintf(fd, "Slow path (lcore %d): %" PRIu64 " punted, dropped %" PRIu64
+        " rate limit, %" PRIu64 " ring full, %u waiting\n",
+        g.ctrl_lcore, punted, limited, full, rte_ring_count(rt_punt_ring));
+    fflush(fd);
+}
@@ -0,0 +1,73 @@
+#ifndef __RT_SLOWPATH_H__
+#define __RT_SLOWPATH_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <rte_lcore.h>
+#include <rte_ring.h>
+
+#include "defines.h"
+#include "pktutils.h"
+
+/*
+ * Slow path on a control lcore (--ctrl-lcore)
+ *
+ * Forwarding lcores hand ("punt") packets that need more than a
+ * Direct Table hit to the control lcore through one multi-producer
+ * ring: DT misses (IPv4 and ARP), local delivery, and entries
+ * invalidated by a table change. Only the control lcore then runs
+ * route lookups, ARP, DHCP and ICMP, creates DT entries and formats
+ * log messages for them, so a burst of new flows no longer stalls
+ * forwarding. Each forwarding lcore may punt --punt-rate packets per
+ * second (bursts of up to RT_PUNT_BURST); what exceeds the rate or
+ * does not fit in the ring is dropped and counted.
+ */
+
+#define RT_PUNT_RING_SIZE   4096
+#define RT_PUNT_BURST       MAX_PKT_BURST
+
+/* Per forwarding lcore: rate limit and packets not yet enqueued */
+typedef struct {
+    uint64_t last;          /* TSC the tokens were last refilled */
+    uint32_t tokens;
+    uint32_t cnt;
+    struct rte_mbuf *mbufs[RT_PUNT_BURST];
+} __rte_cache_aligned rt_punt_lcore_t;
+
+extern rt_punt_lcore_t rt_punt_lcore[RTE_MAX_LCORE];
+extern struct rte_ring *rt_punt_ring;
+
+/* Does the calling lcore punt its slow path packets? */
+static inline int
+rt_punt_active (void)
+{
+    unsigned lcore = rte_lcore_id();
+    return (g.ctrl_lcore >= 0) && (lcore < RTE_MAX_LCORE)
+        && (lcore != (unsigned) g.ctrl_lcore);
+}
+
+/* Are punted packets waiting for 'lcore' (see rt_power_poll)? */
+static inline int
+rt_punt_pending (unsigned lcore)
+{
+    return ((int) lcore == g.ctrl_lcore) && !rte_ring_empty(rt_punt_ring);
+}
+
+void rt_punt (rt_pkt_t pkt);
+void rt_punt_flush_batch (rt_punt_lcore_t *pl);
+
+/* Enqueue what the calling lcore punted, once per received burst */
+static inline void
+rt_punt_flush (void)
+{
+    rt_punt_lcore_t *pl = &rt_punt_lcore[rte_lcore_id()];
+    if (unlikely(pl->cnt > 0))
+        rt_punt_flush_batch(pl);
+}
+
+void rt_punt_init (void);
+int rt_punt_process (void);
+void rt_punt_print_stats (FILE *fd);
+
+#endif
@@ -1,19 +1,57 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <inttypes.h>
+#include <semaphore.h>
 
 #include "stats.h"
 #include "port.h"
+#include "dbgmsg.h"
 
-rt_port_stats_t port_statistics[RTE_MAX_ETHPORTS];
+rt_lcore_stats_t rt_lcore_stats[RT_STATS_SLOTS];
+
+RTE_DEFINE_PER_LCORE(unsigned, _stats_slot) = RT_STATS_ANY_SLOT;
+
+/* Load statistics at the previous print_stats() call */
+static rt_load_stats_t rt_load_stats_prev[RT_MAX_PORT_COUNT];
+
+/*
+ * Sum the counters of one port over all lcores. Each counter is
+ * written by a single lcore with plain 64-bit stores, so reading
+ * without locks yields a consistent value per counter; the sum
+ * itself is a snapshot that may be slightly behind.
+ */
+void
+rt_port_stats_sum (int prtidx, rt_port_stats_t *sum)
+{
+    int slot, idx;
+    memset(sum, 0, sizeof(*sum));
+    for (slot = 0 ; slot < RT_STATS_SLOTS ; slot++) {
+        const volatile rt_port_stats_t *ps =
+            &rt_lcore_stats[slot].port[prtidx];
+        sum->rx += ps->rx;
+        sum->tx += ps->tx;
+        for (idx = 0 ; idx < RT_DISC_REASONS ; idx++)
+            sum->disc[idx] += ps->disc[idx];
+        sum->tx_bursts += ps->tx_bursts;
+        for (idx = 0 ; idx < RT_TXF_REASONS ; idx++)
+            sum->tx_flush[idx] += ps->tx_flush[idx];
+        sum->tx_retried += ps->tx_retried;
+        sum->tx_hold_drop += ps->tx_hold_drop;
+        for (idx = 0 ; idx < LS_COUNTERS ; idx++)
+            sum->ls.cnt[idx] += ps->ls.cnt[idx];
+    }
+}
 
 void
 print_load_statistics (int prtidx)
 {
+    rt_port_stats_t sum;
     rt_load_stats_t delta;
-    rt_load_stats_t *nlsp = &port_statistics[prtidx].ls;
-    rt_load_stats_t *olsp = &port_statistics[prtidx].prev;
+    rt_load_stats_t *nlsp = &sum.ls;
+    rt_load_stats_t *olsp = &rt_load_stats_prev[prtidx];
     uint64_t total = 0;
     int i;
+    rt_port_stats_sum(prtidx, &sum);
     for (i = 0 ; i < LS_COUNTERS ; i++ ) {
         delta.cnt[i] = nlsp->cnt[i] - olsp->cnt[i];
         total += delta.cnt[i];
@@ -40,6 +78,28 @@ print_load_statistics (int prtidx)
     printf("\n");
 }
 
+/*
+ * Processing cost per received packet on each lcore since the last
+ * call (RX, forwarding, TX and freeing discarded packets).
+ */
+static void
+print_lcore_cycles (void)
+{
+    static uint64_t prev_cycles[RTE_MAX_LCORE], prev_pkts[RTE_MAX_LCORE];
+    unsigned lcore_id;
+    for (lcore_id = 0 ; lcore_id < RTE_MAX_LCORE ; lcore_id++) {
+        const volatile rt_lcore_stats_t *ls = &rt_lcore_stats[lcore_id];
+        uint64_t cycles = ls->busy_cycles, pkts = ls->busy_pkts;
+        if (pkts > prev_pkts[lcore_id]) {
+            printf("  lcore %2u: %8.1f cycles/pkt\n", lcore_id,
+                (double) (cycles - prev_cycles[lcore_id])
+                / (double) (pkts - prev_pkts[lcore_id]));
+        }
+        prev_cycles[lcore_id] = cycles;
+        prev_pkts[lcore_id] = pkts;
+    }
+}
+
 /* Print out statistics on packets dropped */
 void
 print_stats (void)
@@ -57,8 +117,9 @@ print_stats (void)
     printf("\n==  Statistics  ========================================="
         "=================\n");
 
-    printf("%5s%12s%12s%9s%9s%9s%9s%9s\n",
-        "Port", "RX", "TX", "QFULL", "DROP", "TERM", "ERROR", "IGNORE");     
+    printf("%5s%12s%12s%9s%9s%9s%9s%9s%9s\n",
+        "Port", "RX", "TX", "QFULL", "DROP", "ERROR", "TERM", "IGNORE",
+        "ARPQ");
 
     #define fmt_l "%12"PRIu64
     #define fmt_s "%9"PRIu64
@@ -66,10 +127,11 @@ print_stats (void)
 
     FOREACH_PORT(prtidx) {
         /* skip disabled ports */
-        rt_port_stats_t *ps = &port_statistics[prtidx];
+        rt_port_stats_t sum, *ps = &sum;
+        rt_port_stats_sum(prtidx, ps);
         printf("%5u" fmt_l fmt_l, prtidx, ps->rx, ps->tx);
         for (idx = 0 ; idx < RT_DISC_REASONS ; idx++) {
-            printf(fmt_s, ts.disc[idx]);
+            printf(fmt_s, ps->disc[idx]);
             ts.disc[idx] += ps->disc[idx];
         }
         ts.rx       += ps->rx;
@@ -91,10 +153,230 @@ print_stats (void)
 
     printf("==========================================================="
         "===============\n");
+
+    #define fmt_m "%10"PRIu64
+
+    printf("%5s%12s%6s%10s%10s%10s%10s%10s%10s\n",
+        "Port", "TX bursts", "avg", "FULL", "TIMEOUT", "IDLE", "LOOP",
+        "RETRIED", "HOLDDROP");
+    FOREACH_PORT(prtidx) {
+        rt_port_stats_t sum, *ps = &sum;
+        rt_port_stats_sum(prtidx, ps);
+        printf("%5u" fmt_l "%6.1f", prtidx, ps->tx_bursts,
+            (ps->tx_bursts > 0)
+                ? (double) ps->tx / (double) ps->tx_bursts : 0.0);
+        for (idx = 0 ; idx < RT_TXF_REASONS ; idx++)
+            printf(fmt_m, ps->tx_flush[idx]);
+        printf(fmt_m fmt_m "\n", ps->tx_retried, ps->tx_hold_drop);
+    }
+
+    printf("==========================================================="
+        "===============\n");
+
+    print_lcore_cycles();
+}
+
+/**********************************************************************/
+/* Indexed counters */
+
+/*
+ * Counter values are never reset, since the per-lcore slots may only
+ * be written by their owner. A recycled index instead remembers the
+ * value it had at allocation time and reports the difference.
+ */
+typedef struct {
+    uint8_t kind;
+    char name[47];
+    rt_cnt_t base;
+} rt_cnt_meta_t;
+
+static rt_cnt_meta_t *rt_cnt_meta;
+static rt_cnt_idx_t *rt_cnt_freelist;
+static int rt_cnt_freecnt;
+static rt_cnt_idx_t rt_cnt_next;
+static sem_t rt_cnt_lock;
+
+static void
+rt_cnt_sum (rt_cnt_idx_t cntidx, rt_cnt_t *sum)
+{
+    int slot;
+    memset(sum, 0, sizeof(*sum));
+    for (slot = 0 ; slot < RT_STATS_SLOTS ; slot++) {
+        const volatile rt_cnt_t *cp = rt_lcore_stats[slot].cnt;
+        if (cp == NULL)
+            continue;
+        sum->pkts += cp[cntidx].pkts;
+        sum->bytes += cp[cntidx].bytes;
+    }
+}
+
+/*
+ * Allocate a counter; returns RT_CNT_NONE when all are in use, in
+ * which case the owner simply goes uncounted.
+ */
+rt_cnt_idx_t
+rt_cnt_alloc (int kind, const char *name)
+{
+    static int warned = 0;
+    rt_cnt_idx_t cntidx = RT_CNT_NONE;
+
+    sem_wait(&rt_cnt_lock);
+    if (rt_cnt_freecnt > 0) {
+        cntidx = rt_cnt_freelist[--rt_cnt_freecnt];
+    } else if (rt_cnt_next < RT_CNT_MAX) {
+        cntidx = rt_cnt_next++;
+    }
+    if (cntidx != RT_CNT_NONE) {
+        rt_cnt_meta_t *mp = &rt_cnt_meta[cntidx];
+        snprintf(mp->name, sizeof(mp->name), "%s", name);
+        rt_cnt_sum(cntidx, &mp->base);
+        mp->kind = kind;
+    }
+    sem_post(&rt_cnt_lock);
+
+    if ((cntidx == RT_CNT_NONE) && !warned) {
+        warned = 1;
+        dbgmsg(WARN, nopkt, "Counter limit (%u) reached", RT_CNT_MAX);
+    }
+    return cntidx;
+}
+
+void
+rt_cnt_free (rt_cnt_idx_t cntidx)
+{
+    if (cntidx == RT_CNT_NONE)
+        return;
+    sem_wait(&rt_cnt_lock);
+    rt_cnt_meta[cntidx].kind = 0;
+    rt_cnt_freelist[rt_cnt_freecnt++] = cntidx;
+    sem_post(&rt_cnt_lock);
+}
+
+typedef struct {
+    rt_cnt_idx_t cntidx;
+    rt_cnt_t val;
+} rt_cnt_top_t;
+
+static inline uint64_t
+rt_cnt_value (const rt_cnt_t *vp, int by_bytes)
+{
+    return by_bytes ? vp->bytes : vp->pkts;
+}
+
+static void
+rt_cnt_print_kind (FILE *fd, const rt_cnt_t *sums, rt_cnt_idx_t limit,
+    int kind, int by_bytes, int count)
+{
+    rt_cnt_top_t top[RT_CNT_TOP_MAX];
+    rt_cnt_idx_t cntidx;
+    int n = 0, i;
+
+    for (cntidx = 1 ; cntidx < limit ; cntidx++) {
+        const rt_cnt_t *vp = &sums[cntidx];
+        uint64_t v = rt_cnt_value(vp, by_bytes);
+        if ((rt_cnt_meta[cntidx].kind != kind) || (v == 0))
+            continue;
+        /* Insertion into the (short) sorted top list */
+        for (i = n ; i > 0 ; i--) {
+            if (rt_cnt_value(&top[i - 1].val, by_bytes) >= v)
+                break;
+            if (i < count)
+                top[i] = top[i - 1];
+        }
+        if (i < count) {
+            top[i].cntidx = cntidx;
+            top[i].val = *vp;
+            if (n < count)
+                n++;
+        }
+    }
+
+    fprintf(fd, "Top %s by %s:\n",
+        (kind == RT_CNT_K_ROUTE) ? "routes" : "flows",
+        by_bytes ? "bytes" : "packets");
+    sem_wait(&rt_cnt_lock);
+    for (i = 0 ; i < n ; i++) {
+        fprintf(fd, "  %14"PRIu64" %16"PRIu64"  %s\n",
+            top[i].val.pkts, top[i].val.bytes,
+            rt_cnt_meta[top[i].cntidx].name);
+    }
+    sem_post(&rt_cnt_lock);
+}
+
+/*
+ * Print the 'count' busiest routes and flows by packets and by bytes
+ */
+void
+rt_cnt_print_top (FILE *fd, int count)
+{
+    rt_cnt_idx_t limit = rt_cnt_next;
+    rt_cnt_idx_t cntidx;
+    int slot;
+
+    if (count > RT_CNT_TOP_MAX)
+        count = RT_CNT_TOP_MAX;
+    rt_cnt_t *sums = (rt_cnt_t *) calloc(limit, sizeof(rt_cnt_t));
+    assert(sums != NULL);
+    for (slot = 0 ; slot < RT_STATS_SLOTS ; slot++) {
+        const volatile rt_cnt_t *cp = rt_lcore_stats[slot].cnt;
+        if (cp == NULL)
+            continue;
+        for (cntidx = 1 ; cntidx < limit ; cntidx++) {
+            sums[cntidx].pkts += cp[cntidx].pkts;
+            sums[cntidx].bytes += cp[cntidx].bytes;
+        }
+    }
+    for (cntidx = 1 ; cntidx < limit ; cntidx++) {
+        sums[cntidx].pkts -= rt_cnt_meta[cntidx].base.pkts;
+        sums[cntidx].bytes -= rt_cnt_meta[cntidx].base.bytes;
+    }
+
+    rt_cnt_print_kind(fd, sums, limit, RT_CNT_K_ROUTE, 0, count);
+    rt_cnt_print_kind(fd, sums, limit, RT_CNT_K_ROUTE, 1, count);
+    rt_cnt_print_kind(fd, sums, limit, RT_CNT_K_FLOW, 0, count);
+    rt_cnt_print_kind(fd, sums, limit, RT_CNT_K_FLOW, 1, count);
+    fflush(fd);
+    free(sums);
 }
 
 void rt_stats_init (void)
 {
-    memset(&port_statistics, 0, sizeof(port_statistics));
+    unsigned lcore_id;
+    int rc;
+
+    memset(&rt_lcore_stats, 0, sizeof(rt_lcore_stats));
+    memset(&rt_load_stats_prev, 0, sizeof(rt_load_stats_prev));
+
+    /* Counter slots for every enabled lcore and the non-EAL slots */
+    RTE_LCORE_FOREACH(lcore_id) {
+        rt_lcore_stats[lcore_id].cnt =
+            (rt_cnt_t *) calloc(RT_CNT_MAX, sizeof(rt_cnt_t));
+        assert(rt_lcore_stats[lcore_id].cnt != NULL);
+    }
+    for (lcore_id = RTE_MAX_LCORE ; lcore_id < RT_STATS_SLOTS ; lcore_id++) {
+        rt_lcore_stats[lcore_id].cnt =
+            (rt_cnt_t *) calloc(RT_CNT_MAX, sizeof(rt_cnt_t));
+        assert(rt_lcore_stats[lcore_id].cnt != NULL);
+    }
+
+    rt_cnt_meta = (rt_cnt_meta_t *) calloc(RT_CNT_MAX, sizeof(rt_cnt_meta_t));
+    rt_cnt_freelist = (rt_cnt_idx_t *)
+        calloc(RT_CNT_MAX, sizeof(rt_cnt_idx_t));
+    assert(rt_cnt_meta != NULL);
+    assert(rt_cnt_freelist != NULL);
+    rt_cnt_freecnt = 0;
+    rt_cnt_next = RT_CNT_NONE + 1;
+    rc = sem_init(&rt_cnt_lock, 1, 1);
+    assert(rc == 0);
+}
+
+/*
+ * Called first thing by a thread that is not an EAL lcore, so that it
+ * counts into a slot of its own (RT_STATS_*_SLOT)
+ */
+void rt_stats_thread_slot (unsigned slot)
+{
+    assert((slot >= RTE_MAX_LCORE) && (slot < RT_STATS_SLOTS));
+    RTE_PER_LCORE(_stats_slot) = slot;
 }
 
@@ -1,6 +1,12 @@
 #ifndef __RT_STATS_H__
 #define __RT_STATS_H__
 
+#include <stdio.h>
+
+#include <rte_memory.h>
+#include <rte_lcore.h>
+#include <rte_branch_prediction.h>
+
 #include "defines.h"
 
 typedef int rt_cnt_idx_t;
@@ -22,21 +28,102 @@ typedef uint8_t rt_disc_cause_t;
 #define RT_DISC_ERROR       2
 #define RT_DISC_TERM        3
 #define RT_DISC_IGNORE      4
-#define RT_DISC_REASONS     5
+#define RT_DISC_ARPQ        5   /* ARP pending queue full */
+#define RT_DISC_REASONS     6
+
+/* Why a thread-private TX queue was flushed (see tx_queue_drain) */
+#define RT_TXF_FULL         0   /* Batch full */
+#define RT_TXF_TIMEOUT      1   /* Latency budget reached */
+#define RT_TXF_IDLE         2   /* RX found nothing to do */
+#define RT_TXF_LOOP         3   /* Every loop iteration */
+#define RT_TXF_REASONS      4
+
+/*
+ * Indexed packet/byte counters for routes and DT entries ("flows").
+ * Index 0 (RT_CNT_NONE) is never allocated and is not counted.
+ */
+#define RT_CNT_NONE         0
+#define RT_CNT_MAX          (1 << 17)
+#define RT_CNT_TOP_MAX      64
+
+#define RT_CNT_K_ROUTE      1
+#define RT_CNT_K_FLOW       2
+
+typedef struct {
+    uint64_t pkts;
+    uint64_t bytes;
+} rt_cnt_t;
 
 /* Per-port statistics struct */
 typedef struct {
     uint64_t rx;
     uint64_t tx;
     uint64_t disc[RT_DISC_REASONS];
-    rt_load_stats_t ls, prev;
+    uint64_t tx_bursts;     /* rte_eth_tx_burst() calls sending packets */
+    uint64_t tx_flush[RT_TXF_REASONS];
+    uint64_t tx_retried;    /* Held after TX queue full, sent later */
+    uint64_t tx_hold_drop;  /* Held too long, dropped (also in QFULL) */
+    rt_load_stats_t ls;
 } rt_port_stats_t;
 
-extern rt_port_stats_t port_statistics[RTE_MAX_ETHPORTS];
+/*
+ * Counters are kept per lcore so that forwarding lcores never write
+ * to a shared cache line; each block is only written by its owner
+ * and print_stats() sums over all blocks when reading. Threads that
+ * are not EAL lcores have slots of their own after those of the
+ * lcores (see rt_stats_thread_slot).
+ */
+typedef struct {
+    rt_cnt_t *cnt;      /* Indexed counters (see rt_cnt_alloc) */
+    uint64_t dt_miss;   /* Direct-Table lookup misses (IPv4) */
+    /* Main loop iterations that received packets: TSC cycles spent
+     * and packets received */
+    uint64_t busy_cycles;
+    uint64_t busy_pkts;
+    /* Packets handed to the control lcore (--ctrl-lcore), and those
+     * dropped by the punt rate limit or because the ring was full */
+    uint64_t punted;
+    uint64_t punt_limited;
+    uint64_t punt_full;
+    /* Packets selected for capture (--capture-file), those queued
+     * for the writer after sampling, and those lost for lack of an
+     * mbuf or room in the ring */
+    uint64_t cap_matched;
+    uint64_t captured;
+    uint64_t cap_dropped;
+    rt_port_stats_t port[RT_MAX_PORT_COUNT];
+} __rte_cache_aligned rt_lcore_stats_t;
+
+#define RT_STATS_HK_SLOT    (RTE_MAX_LCORE + 0) /* Housekeeping thread */
+#define RT_STATS_LOG_SLOT   (RTE_MAX_LCORE + 1) /* Log writer thread */
+#define RT_STATS_CAP_SLOT   (RTE_MAX_LCORE + 2) /* Capture writer thread */
+#define RT_STATS_ANY_SLOT   (RTE_MAX_LCORE + 3) /* Any other thread */
+#define RT_STATS_SLOTS      (RTE_MAX_LCORE + 4)
+
+extern rt_lcore_stats_t rt_lcore_stats[RT_STATS_SLOTS];
+
+/* Slot of the calling thread when it is not an EAL lcore */
+RTE_DECLARE_PER_LCORE(unsigned, _stats_slot);
+
+static inline rt_lcore_stats_t *
+rt_lcore_stats_self (void)
+{
+    unsigned lcore_id = rte_lcore_id();
+    if (unlikely(lcore_id >= RTE_MAX_LCORE))
+        lcore_id = RTE_PER_LCORE(_stats_slot);
+    return &rt_lcore_stats[lcore_id];
+}
+
+static inline rt_port_stats_t *
+rt_port_stats (int prtidx)
+{
+    return &rt_lcore_stats_self()->port[prtidx];
+}
 
 static inline void
 update_load_statistics (int prtidx, int rx_pkt_cnt)
 {
+    rt_load_stats_t *ls = &rt_port_stats(prtidx)->ls;
     int offset;
     if (rx_pkt_cnt == 0) {
         offset = LS_EMPTY;
@@ -44,23 +131,30 @@ update_load_statistics (int prtidx, int rx_pkt_cnt)
         offset = LS_SINGLE;
     } else if (rx_pkt_cnt < MAX_PKT_BURST) {
         offset = LS_PARTIAL;
-        port_statistics[prtidx].ls.cnt[LS_PKTCNT] += rx_pkt_cnt;
+        ls->cnt[LS_PKTCNT] += rx_pkt_cnt;
     } else {
         offset = LS_FULL;
     }
-    port_statistics[prtidx].ls.cnt[offset]++;
+    ls->cnt[offset]++;
 }
 
-static int aaaa = 0;
-
 static inline void
-rt_stats_incr (rt_cnt_idx_t cntidx)
+rt_stats_incr (rt_cnt_idx_t cntidx, uint32_t bytes)
 {
-    aaaa = cntidx; // dummy
+    rt_cnt_t *cp = rt_lcore_stats_self()->cnt;
+    if ((cntidx == RT_CNT_NONE) || unlikely(cp == NULL))
+        return;
+    cp[cntidx].pkts++;
+    cp[cntidx].bytes += bytes;
 }
 
+void rt_port_stats_sum (int prtidx, rt_port_stats_t *sum);
+rt_cnt_idx_t rt_cnt_alloc (int kind, const char *name);
+void rt_cnt_free (rt_cnt_idx_t cntidx);
+void rt_cnt_print_top (FILE *fd, int count);
 void print_load_statistics (int prtidx);
 void print_stats (void);
 void rt_stats_init (void);
+void rt_stats_thread_slot (unsigned slot);
 
 #endif
@@ -1,84 +1,259 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <inttypes.h>
 #include <semaphore.h>
 
+#include <rte_atomic.h>
+#include <rte_prefetch.h>
+#include <rte_cycles.h>
+#include <rte_spinlock.h>
+
 #include "tables.h"
+#include "numa.h"
 #include "dbgmsg.h"
 #include "functions.h"
 
 /**********************************************************************/
 /*  Direct Table (Must be FAST) */
 
-rt_dt_route_t rt_dt_table[RT_DT_SIZE];
+/*
+ * Readers (forwarding lcores) never lock. The table is a bucketized
+ * two-choice hash: a key lives in one of two candidate buckets and is
+ * never moved once inserted. Inserts are serialized by a writer lock,
+ * so that a key is never published twice; the writer claims an empty
+ * signature slot with a compare-and-swap (removals do not take the
+ * lock), fills in the result entry and publishes the signature last.
+ * The forwarding information of an entry is replaced as a whole by
+ * pointer swap and released through QSBR.
+ */
+
+rt_dt_table_t rt_dt_table;
+volatile uint32_t rt_dt_clock;
+
+static rte_spinlock_t rt_dt_dep_lock;
+static rte_spinlock_t rt_dt_insert_lock;
 
-static sem_t rt_dt_lock;
+static void rt_dt_dep_unlink (uint32_t ridx);
+
+static rt_dt_fwd_t *
+rt_dt_fwd_alloc (const rt_dt_fwd_t *sp)
+{
+    rt_dt_fwd_t *fwd = (rt_dt_fwd_t *) rt_numa_entry_alloc(sizeof(rt_dt_fwd_t));
+    if (sp != NULL) {
+        memcpy(fwd, sp, sizeof(rt_dt_fwd_t));
+    } else {
+        memset(fwd, 0, sizeof(rt_dt_fwd_t));
+        fwd->flags = RT_FWD_F_DISCARD;
+    }
+    return fwd;
+}
 
 static void
-rt_dt_copy_fwd_info (rt_dt_route_t *dp, const rt_dt_route_t *sp)
+rt_dt_publish_fwd (rt_dt_route_t *dt, rt_dt_fwd_t *fwd)
 {
-    if (dp->pi != sp->pi) {
-        /* Temporarily set the entry to DISCARD */
-        dp->flags = RT_FWD_F_DISCARD;
+    rt_dt_fwd_t *old = __atomic_exchange_n(&dt->fwd, fwd, __ATOMIC_ACQ_REL);
+    if (old != NULL)
+        rt_rcu_defer(rt_numa_free, old);
+}
+
+static int
+rt_dt_bucket_load (const rt_dt_bucket_t *bp)
+{
+    int i, cnt = 0;
+    for (i = 0 ; i < RT_DT_BUCKET_ENTRIES ; i++) {
+        if (bp->sig[i] != RT_DT_SIG_EMPTY)
+            cnt++;
     }
-    dp->pi = sp->pi;
-    dp->port = sp->port;
-    memcpy(dp->eth.dst, sp->eth.dst, 6);
-    memcpy(dp->eth.src, sp->eth.src, 6);
-    dp->flags = sp->flags;
+    return cnt;
 }
 
-rt_dt_route_t *
-rt_dt_find_or_create (const rt_dt_key_t *key, const rt_dt_route_t *tp)
+/*
+ * Claim an empty slot in a bucket. Returns the slot number or -1.
+ */
+static int
+rt_dt_bucket_claim (rt_dt_bucket_t *bp)
 {
-    /* Allocate new entry (just in case) */
-    rt_dt_route_t *ap = (rt_dt_route_t *) malloc(sizeof(rt_dt_route_t));
-    assert(ap != NULL);
-    memset(ap, 0, sizeof(rt_dt_route_t));
+    int i;
+    for (i = 0 ; i < RT_DT_BUCKET_ENTRIES ; i++) {
+        if ((bp->sig[i] == RT_DT_SIG_EMPTY)
+                && __sync_bool_compare_and_swap(&bp->sig[i],
+                    RT_DT_SIG_EMPTY, RT_DT_SIG_BUSY))
+            return i;
+    }
+    return -1;
+}
 
-    int idx = rt_dt_hash(key);
-    rt_dt_route_t *hd = &rt_dt_table[idx];
+/*
+ * Result indices of removed entries are recycled through a free
+ * stack; the ones never used yet are handed out from 'route_next'.
+ */
+static uint32_t
+rt_dt_index_alloc (void)
+{
+    uint32_t ridx = RT_DT_IDX_NONE;
+    rte_spinlock_lock(&rt_dt_table.free_lock);
+    if (rt_dt_table.free_cnt > 0)
+        ridx = rt_dt_table.free_idx[--rt_dt_table.free_cnt];
+    rte_spinlock_unlock(&rt_dt_table.free_lock);
+    if (ridx != RT_DT_IDX_NONE)
+        return ridx;
+    /* Stop counting at the end, so that it never wraps around */
+    ridx = __atomic_load_n(&rt_dt_table.route_next, __ATOMIC_RELAXED);
+    do {
+        if (ridx >= rt_dt_table.route_count)
+            return RT_DT_IDX_NONE;
+    } while (!__atomic_compare_exchange_n(&rt_dt_table.route_next, &ridx,
+        ridx + 1, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return ridx;
+}
+
+/*
+ * Second half of an entry removal, run once no reader can still hold
+ * the entry (deferred through QSBR).
+ */
+static void
+rt_dt_release_index (void *arg)
+{
+    uint32_t ridx = (uint32_t) (uintptr_t) arg;
+    rt_dt_route_t *rp = &rt_dt_table.routes[ridx];
+
+    /* The slow path may have relinked it before the grace period */
+    rte_spinlock_lock(&rt_dt_dep_lock);
+    rt_dt_dep_unlink(ridx);
+    rte_spinlock_unlock(&rt_dt_dep_lock);
+
+    rt_dt_fwd_t *fwd = __atomic_exchange_n(&rp->fwd, NULL, __ATOMIC_ACQ_REL);
+    if (fwd != NULL) {
+        rt_cnt_free(fwd->cntidx);
+        rt_numa_free(fwd);
+    }
+
+    rte_spinlock_lock(&rt_dt_table.free_lock);
+    rt_dt_table.free_idx[rt_dt_table.free_cnt++] = ridx;
+    rte_spinlock_unlock(&rt_dt_table.free_lock);
+}
+
+/*
+ * Remove the entry in slot 'slot' if it still holds signature 'sig'.
+ * Readers stop finding it at once; its result index is reused only
+ * after a grace period. Returns 1 if the entry was removed.
+ */
+static int
+rt_dt_remove_slot (rt_dt_bucket_t *bp, int slot, uint16_t sig)
+{
+    if (!__sync_bool_compare_and_swap(&bp->sig[slot], sig, RT_DT_SIG_EMPTY))
+        return 0;
+    /* 'idx' does not change while the signature is published */
+    uint32_t ridx = bp->idx[slot];
+    __atomic_fetch_sub(&rt_dt_table.route_used, 1, __ATOMIC_RELAXED);
+    rte_spinlock_lock(&rt_dt_dep_lock);
+    rt_dt_dep_unlink(ridx);
+    rte_spinlock_unlock(&rt_dt_dep_lock);
+    rt_rcu_defer(rt_dt_release_index, (void *) (uintptr_t) ridx);
+    return 1;
+}
+
+static rt_cnt_idx_t
+rt_dt_cnt_alloc (const rt_dt_key_t *key)
+{
+    char name[64], ts0[20], ts1[20];
+    snprintf(name, sizeof(name), "p%u %s %s", key->prtidx,
+        rt_hwaddr_str(ts0, key->hwaddr), rt_ipaddr_str(ts1, key->ipaddr));
+    return rt_cnt_alloc(RT_CNT_K_FLOW, name);
+}
+
+/*
+ * Insert a new entry for 'key'. Called with rt_dt_insert_lock held,
+ * after checking that the key is not in the table.
+ */
+static rt_dt_route_t *
+rt_dt_insert (const rt_dt_key_t *key, const rt_dt_fwd_t *fwd,
+    uint32_t hash, uint16_t sig)
+{
+    uint32_t bidx[2];
     rt_dt_route_t *sp;
 
-    int created = 0;
-    sem_wait(&rt_dt_lock);
-    for (sp = hd ; ; sp = sp->next) {
-        if (rt_dt_key_compare(key, &sp->key) == 0)
-            break;
-        if (sp->next == hd) {
-            if ((sp != hd) || (hd->used == 0)) {
-                /* Insert 'ap' at end of list */
-                ap->next = hd;
-                ap->prev = hd->prev;
-                hd->prev->next = ap;
-                hd->prev = ap;
-                sp = ap;
-                ap = NULL;
-            }
-            memcpy(&sp->key, key, sizeof(rt_dt_key_t));
-            if (tp != NULL) {
-                rt_dt_copy_fwd_info(sp, tp);
-            } else {
-                sp->flags = RT_FWD_F_DISCARD;
-            }
-            sp->used = 1;
-            created = 1;
-            break;
-        }
+    /* Try the less loaded of the two candidate buckets first */
+    bidx[0] = rt_dt_bucket_prim(hash);
+    bidx[1] = rt_dt_bucket_alt(bidx[0], sig);
+    if (rt_dt_bucket_load(&rt_dt_table.buckets[bidx[1]])
+            < rt_dt_bucket_load(&rt_dt_table.buckets[bidx[0]])) {
+        uint32_t t = bidx[0];
+        bidx[0] = bidx[1];
+        bidx[1] = t;
     }
-    sem_post(&rt_dt_lock);
 
-    if (created) {
-        char ts0[20], ts1[20], ts2[20], ts3[20];
-        dbgmsg(INFO, nopkt, "Creating DT (p%u %s %s) -> (p%u %s -> %s)",
-            key->prtidx, rt_hwaddr_str(ts0, key->hwaddr),
-            rt_ipaddr_str(ts1, key->ipaddr),
-            tp->port, rt_hwaddr_str(ts2, tp->eth.src),
-            rt_hwaddr_str(ts3, tp->eth.dst));
+    rt_dt_bucket_t *bp = NULL;
+    int slot = -1;
+    int b;
+    for (b = 0 ; (b < 2) && (slot < 0) ; b++) {
+        bp = &rt_dt_table.buckets[bidx[b]];
+        slot = rt_dt_bucket_claim(bp);
+    }
+    if (slot < 0) {
+        char ts[32];
+        __atomic_fetch_add(&rt_dt_table.insert_fail, 1, __ATOMIC_RELAXED);
+        dbgmsg(WARN, nopkt, "DT buckets full for (p%u %s)",
+            key->prtidx, rt_ipaddr_str(ts, key->ipaddr));
+        return NULL;
     }
 
-    /* If the ap was not used (ap != NULL), then relase it */
-    free(ap);
+    uint32_t ridx = rt_dt_index_alloc();
+    if (ridx == RT_DT_IDX_NONE) {
+        rt_rcu_assign_pointer(bp->sig[slot], RT_DT_SIG_EMPTY);
+        __atomic_fetch_add(&rt_dt_table.insert_fail, 1, __ATOMIC_RELAXED);
+        dbgmsg(WARN, nopkt, "DT result array full (%u entries)",
+            rt_dt_table.route_count);
+        return NULL;
+    }
+    __atomic_fetch_add(&rt_dt_table.route_used, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&rt_dt_table.inserts, 1, __ATOMIC_RELAXED);
+
+    /* Fill in the result entry, then publish the signature */
+    sp = &rt_dt_table.routes[ridx];
+    memcpy(&sp->key, key, sizeof(rt_dt_key_t));
+    sp->used = rt_dt_clock;
+    sp->fwd = rt_dt_fwd_alloc(fwd);
+    sp->fwd->cntidx = rt_dt_cnt_alloc(key);
+    bp->idx[slot] = ridx;
+    rt_rcu_assign_pointer(bp->sig[slot], sig);
+
+    char ts0[20], ts1[20], ts2[20], ts3[20];
+    const rt_dt_fwd_t *fp = sp->fwd;
+    dbgmsg(INFO, nopkt, "Creating DT (p%u %s %s) -> (p%u %s -> %s)",
+        key->prtidx, rt_hwaddr_str(ts0, key->hwaddr),
+        rt_ipaddr_str(ts1, key->ipaddr),
+        fp->port, rt_hwaddr_str(ts2, fp->eth.src),
+        rt_hwaddr_str(ts3, fp->eth.dst));
+
+    return sp;
+}
+
+rt_dt_route_t *
+rt_dt_find_or_create (const rt_dt_key_t *key, const rt_dt_fwd_t *fwd)
+{
+    rt_dt_route_t *sp;
 
+    sp = rt_dt_route_find(key);
+    if (sp == NULL) {
+        /* Look again under the lock: another writer may have won */
+        rte_spinlock_lock(&rt_dt_insert_lock);
+        sp = rt_dt_route_find(key);
+        if (sp == NULL) {
+            uint32_t hash = rt_dt_hash(key);
+            sp = rt_dt_insert(key, fwd, hash, rt_dt_sig(hash));
+            rte_spinlock_unlock(&rt_dt_insert_lock);
+            return sp;
+        }
+        rte_spinlock_unlock(&rt_dt_insert_lock);
+    }
+    if (fwd != NULL) {
+        /* The flow counter stays with the entry */
+        rt_dt_fwd_t nf = *fwd;
+        nf.cntidx = rt_rcu_dereference(sp->fwd)->cntidx;
+        if (memcmp(sp->fwd, &nf, sizeof(rt_dt_fwd_t)) != 0)
+            rt_dt_publish_fwd(sp, rt_dt_fwd_alloc(&nf));
+    }
     return sp;
 }
 
@@ -89,27 +264,26 @@ void rt_dt_set_fwd_info (rt_dt_route_t *dt, rt_lpm_t *rt, rt_ipv4_ar_t *ar,
     rt_port_info_t *pi = rt->pi;
     assert(pi != NULL);
 
-    sem_wait(&rt_dt_lock);
+    rt_dt_fwd_t *fwd = rt_dt_fwd_alloc(rt_rcu_dereference(dt->fwd));
 
-    dt->port = pi->idx;
-    memcpy(&dt->eth.src, &pi->hwaddr, 6);
+    fwd->pi = pi;
+    fwd->port = pi->idx;
+    memcpy(&fwd->eth.src, &pi->hwaddr, 6);
     if (ar != NULL) {
-        memcpy(&dt->eth.dst, ar->hwaddr, 6);
+        memcpy(&fwd->eth.dst, ar->hwaddr, 6);
     }
+    fwd->flags = flags;
+    fwd->rtcntidx = rt->cntidx;
 
-    /* Change Flags last */
-    dt->flags = flags;
-
-    sem_post(&rt_dt_lock);
+    rt_dt_publish_fwd(dt, fwd);
 }
 
 rt_dt_route_t *
-rt_dt_create (const rt_dt_route_t *drp)
+rt_dt_create (const rt_dt_key_t *key, const rt_dt_fwd_t *fwd)
 {
-    rt_dt_route_t *np = rt_dt_find_or_create(&drp->key, drp);
-    assert(np != NULL);
-
-    return np;
+    /* May fail (NULL) when the table is full - the packet is still
+     * forwarded through the slow path */
+    return rt_dt_find_or_create(key, fwd);
 }
 
 rt_dt_route_t *
@@ -117,27 +291,245 @@ rt_dt_create_exception (rt_port_info_t *pi, rt_ipv4_addr_t ipaddr,
     uint8_t flags)
 {
     /* Create a LOCAL Direct-Table Entry */
-    rt_dt_route_t dt;
-    memset(&dt, 0, sizeof(dt));
-    dt.key.prtidx = pi->idx;
-    dt.key.ipaddr = ipaddr;
-    memcpy(dt.key.hwaddr, pi->hwaddr, 6);
+    rt_dt_key_t key;
+    rt_dt_fwd_t fwd;
+    memset(&key, 0, sizeof(key));
+    memset(&fwd, 0, sizeof(fwd));
+    key.prtidx = pi->idx;
+    key.ipaddr = ipaddr;
+    memcpy(key.hwaddr, pi->hwaddr, 6);
     assert(flags != 0);
-    dt.flags = flags;
-    return rt_dt_create(&dt);
+    fwd.flags = flags;
+    return rt_dt_create(&key, &fwd);
 }
 
 void
-rt_dt_init (void)
+rt_dt_init (uint32_t size, uint32_t budget)
 {
-    int i;
-    for (i = 0 ; i < RT_DT_SIZE ; i++) {
-        rt_dt_route_t *p = &rt_dt_table[i];
-        memset(p, 0, sizeof(rt_dt_route_t));
-        p->prev = p->next = p;
+    uint32_t bcnt = 1;
+    while (bcnt * RT_DT_BUCKET_ENTRIES < size)
+        bcnt <<= 1;
+    uint32_t rcnt = bcnt * RT_DT_BUCKET_ENTRIES;
+    rt_dt_table.buckets = (rt_dt_bucket_t *)
+        rt_numa_table_alloc("DT buckets", bcnt * sizeof(rt_dt_bucket_t));
+    rt_dt_table.routes = (rt_dt_route_t *)
+        rt_numa_table_alloc("DT routes", rcnt * sizeof(rt_dt_route_t));
+    rt_dt_table.deps = (rt_dt_dep_t *)
+        rt_numa_table_alloc("DT dependencies", rcnt * sizeof(rt_dt_dep_t));
+    rt_dt_table.free_idx = (uint32_t *)
+        rt_numa_table_alloc("DT free indices", rcnt * sizeof(uint32_t));
+    rte_spinlock_init(&rt_dt_dep_lock);
+    rte_spinlock_init(&rt_dt_insert_lock);
+    rt_dt_table.bucket_mask = bcnt - 1;
+    rt_dt_table.route_count = bcnt * RT_DT_BUCKET_ENTRIES;
+    rt_dt_table.route_next = 0;
+    rt_dt_table.route_used = 0;
+    rte_spinlock_init(&rt_dt_table.free_lock);
+    rt_dt_table.free_cnt = 0;
+    rt_dt_table.hand = 0;
+    rt_dt_table.inserts = 0;
+    rt_dt_table.insert_fail = 0;
+    rt_dt_table.evict_idle = 0;
+    rt_dt_table.evict_budget = 0;
+    /* Default: keep a quarter of the buckets' slots free, which leaves
+     * room in the two candidate buckets of most new keys */
+    if ((budget == 0) || (budget > rt_dt_table.route_count))
+        budget = rt_dt_table.route_count / 4 * 3;
+    rt_dt_table.budget = budget;
+    rt_dt_clock = 1;
+    dbgmsg(CONF, nopkt, "DT size: %u buckets, %u entries, budget %u",
+        bcnt, rt_dt_table.route_count, rt_dt_table.budget);
+}
+
+/*
+ * CLOCK-style eviction, called from the housekeeping thread. The hand
+ * visits a few buckets per call; the 'used' stamp of an entry acts as
+ * its reference bit. Entries idle for 'g.dt_idle' seconds are removed;
+ * while the table is over budget, any entry not used during the
+ * current second is removed as well. The hand moves faster when over
+ * budget.
+ */
+void
+rt_dt_sweep (void)
+{
+    uint32_t now = rt_dt_clock;
+    uint32_t nb = RT_DT_SWEEP_BUCKETS;
+    int over = rt_dt_table.route_used > rt_dt_table.budget;
+    if (over)
+        nb *= 8;
+    if (nb > rt_dt_table.bucket_mask + 1)
+        nb = rt_dt_table.bucket_mask + 1;
+
+    while (nb-- > 0) {
+        rt_dt_bucket_t *bp = &rt_dt_table.buckets[rt_dt_table.hand];
+        rt_dt_table.hand = (rt_dt_table.hand + 1) & rt_dt_table.bucket_mask;
+        int i;
+        for (i = 0 ; i < RT_DT_BUCKET_ENTRIES ; i++) {
+            uint16_t sig = rt_rcu_dereference(bp->sig[i]);
+            if (sig < RT_DT_SIG_MIN)
+                continue;
+            const rt_dt_route_t *rp = &rt_dt_table.routes[bp->idx[i]];
+            uint32_t idle = now - rp->used;
+            if ((g.dt_idle > 0) && (idle >= g.dt_idle)) {
+                if (rt_dt_remove_slot(bp, i, sig))
+                    rt_dt_table.evict_idle++;
+            } else if (over && (idle > 0)) {
+                if (rt_dt_remove_slot(bp, i, sig)) {
+                    rt_dt_table.evict_budget++;
+                    over = rt_dt_table.route_used > rt_dt_table.budget;
+                }
+            }
+        }
     }
-    int rc = sem_init(&rt_dt_lock, 1, 1);
-    assert(rc == 0);
+}
+
+void
+rt_dt_print_stats (FILE *fd)
+{
+    uint64_t miss = 0;
+    unsigned slot;
+    for (slot = 0 ; slot < RT_STATS_SLOTS ; slot++)
+        miss += rt_lcore_stats[slot].dt_miss;
+    fprintf(fd, "DT: %u/%u entries (budget %u), %" PRIu64 " inserts, "
+        "%" PRIu64 " misses, %" PRIu64 " failed, evicted %" PRIu64
+        " idle %" PRIu64 " budget\n",
+        rt_dt_table.route_used, rt_dt_table.route_count, rt_dt_table.budget,
+        rt_dt_table.inserts, miss, rt_dt_table.insert_fail,
+        rt_dt_table.evict_idle, rt_dt_table.evict_budget);
+    fflush(fd);
+}
+
+/**********************************************************************/
+/*  Direct Table dependencies */
+
+/*
+ * Writers only: the lists are kept under 'rt_dt_dep_lock'. Readers
+ * never look at them. An invalidated entry is not unlinked; the slow
+ * path relinks it when it rebuilds the entry.
+ */
+
+static inline int
+rt_prefix_match (const rt_ipv4_prefix_t *prefix, rt_ipv4_addr_t addr)
+{
+    uint32_t mask = (prefix->len == 0) ? 0 : ~0U << (32 - prefix->len);
+    return ((addr ^ prefix->addr) & mask) == 0;
+}
+
+/* Must be called with 'rt_dt_dep_lock' held */
+static void
+rt_dt_dep_unlink (uint32_t ridx)
+{
+    rt_dt_dep_t *deps = rt_dt_table.deps;
+    rt_dt_dep_t *dp = &deps[ridx];
+    if (dp->rt != NULL) {
+        if (dp->rt_prev != RT_DT_IDX_NONE)
+            deps[dp->rt_prev].rt_next = dp->rt_next;
+        else
+            dp->rt->dt_head = dp->rt_next;
+        if (dp->rt_next != RT_DT_IDX_NONE)
+            deps[dp->rt_next].rt_prev = dp->rt_prev;
+        dp->rt = NULL;
+    }
+    if (dp->ar != NULL) {
+        if (dp->ar_prev != RT_DT_IDX_NONE)
+            deps[dp->ar_prev].ar_next = dp->ar_next;
+        else
+            dp->ar->dt_head = dp->ar_next;
+        if (dp->ar_next != RT_DT_IDX_NONE)
+            deps[dp->ar_next].ar_prev = dp->ar_prev;
+        dp->ar = NULL;
+    }
+}
+
+/* Must be called with 'rt_dt_dep_lock' held */
+static int
+rt_dt_invalidate_entry (rt_dt_route_t *dt)
+{
+    const rt_dt_fwd_t *fwd = rt_rcu_dereference(dt->fwd);
+    if (fwd->flags & RT_FWD_F_INVALID)
+        return 0;
+    rt_dt_fwd_t *nf = rt_dt_fwd_alloc(fwd);
+    nf->flags |= RT_FWD_F_INVALID;
+    rt_dt_publish_fwd(dt, nf);
+    return 1;
+}
+
+/*
+ * Record that 'dt' was built from route 'rt' and AR entry 'ar' (may be
+ * NULL). The generation numbers are the ones the caller read before
+ * looking at 'rt' and 'ar': if either changed meanwhile, the entry may
+ * already be outdated and is invalidated right away.
+ */
+void
+rt_dt_depend (rt_dt_route_t *dt, rt_lpm_t *rt, uint32_t rt_gen,
+    rt_ipv4_ar_t *ar, uint32_t ar_gen)
+{
+    uint32_t ridx = dt - rt_dt_table.routes;
+    rt_dt_dep_t *deps = rt_dt_table.deps;
+    rt_dt_dep_t *dp = &deps[ridx];
+
+    rte_spinlock_lock(&rt_dt_dep_lock);
+    if ((dp->rt != rt) || (dp->ar != ar)) {
+        rt_dt_dep_unlink(ridx);
+        dp->rt = rt;
+        dp->rt_prev = RT_DT_IDX_NONE;
+        dp->rt_next = rt->dt_head;
+        if (rt->dt_head != RT_DT_IDX_NONE)
+            deps[rt->dt_head].rt_prev = ridx;
+        rt->dt_head = ridx;
+        if (ar != NULL) {
+            dp->ar = ar;
+            dp->ar_prev = RT_DT_IDX_NONE;
+            dp->ar_next = ar->dt_head;
+            if (ar->dt_head != RT_DT_IDX_NONE)
+                deps[ar->dt_head].ar_prev = ridx;
+            ar->dt_head = ridx;
+        }
+    }
+    if ((rt->dt_gen != rt_gen) || ((ar != NULL) && (ar->dt_gen != ar_gen)))
+        rt_dt_invalidate_entry(dt);
+    rte_spinlock_unlock(&rt_dt_dep_lock);
+}
+
+/*
+ * Invalidate the DT entries built from route 'rt' - all of them, or
+ * only those for destinations 'within' a prefix (a more specific route
+ * was added). Returns the number of entries invalidated.
+ */
+int
+rt_dt_invalidate_route (rt_lpm_t *rt, const rt_ipv4_prefix_t *within)
+{
+    int cnt = 0;
+    rte_spinlock_lock(&rt_dt_dep_lock);
+    __atomic_add_fetch(&rt->dt_gen, 1, __ATOMIC_RELEASE);
+    uint32_t ridx;
+    for (ridx = rt->dt_head ; ridx != RT_DT_IDX_NONE ;
+            ridx = rt_dt_table.deps[ridx].rt_next) {
+        rt_dt_route_t *dt = &rt_dt_table.routes[ridx];
+        if ((within == NULL) || rt_prefix_match(within, dt->key.ipaddr))
+            cnt += rt_dt_invalidate_entry(dt);
+    }
+    rte_spinlock_unlock(&rt_dt_dep_lock);
+    return cnt;
+}
+
+/*
+ * Invalidate the DT entries that forward to the next hop of 'ar'.
+ * Returns the number of entries invalidated.
+ */
+int
+rt_dt_invalidate_ar (rt_ipv4_ar_t *ar)
+{
+    int cnt = 0;
+    rte_spinlock_lock(&rt_dt_dep_lock);
+    __atomic_add_fetch(&ar->dt_gen, 1, __ATOMIC_RELEASE);
+    uint32_t ridx;
+    for (ridx = ar->dt_head ; ridx != RT_DT_IDX_NONE ;
+            ridx = rt_dt_table.deps[ridx].ar_next) {
+        cnt += rt_dt_invalidate_entry(&rt_dt_table.routes[ridx]);
+    }
+    rte_spinlock_unlock(&rt_dt_dep_lock);
+    return cnt;
 }
 
 int
@@ -145,28 +537,71 @@ rt_dt_sprintf (char *str, const rt_dt_route_t *dt)
 {
     int n = 0;
     char ts1[32], ts2[32];
+    const rt_dt_fwd_t *fwd = rt_rcu_dereference(dt->fwd);
     n += sprintf(&str[n], "(%u) %s - P: %u D: %s", dt->key.prtidx,
-        rt_ipaddr_str(ts1, dt->key.ipaddr), dt->port,
-        rt_hwaddr_str(ts2, dt->eth.dst));
-    n += sprintf(&str[n], " S: %s", rt_hwaddr_str(ts1, dt->eth.src));
+        rt_ipaddr_str(ts1, dt->key.ipaddr), fwd->port,
+        rt_hwaddr_str(ts2, fwd->eth.dst));
+    n += sprintf(&str[n], " S: %s", rt_hwaddr_str(ts1, fwd->eth.src));
     return n;
 }
 
 void
 rt_dt_dump (FILE *fd)
 {
-    int i;
-    for (i = 0 ; i < RT_DT_SIZE ; i++) {
-        rt_dt_route_t *hd = &rt_dt_table[i];
-        rt_dt_route_t *p = hd;
-        int i = 0;
-        do {
-//            if (p->rdidx == 0)
-//                continue;
+    uint32_t bidx;
+    for (bidx = 0 ; bidx <= rt_dt_table.bucket_mask ; bidx++) {
+        const rt_dt_bucket_t *bp = &rt_dt_table.buckets[bidx];
+        int i, j = 0;
+        for (i = 0 ; i < RT_DT_BUCKET_ENTRIES ; i++) {
+            if (rt_rcu_dereference(bp->sig[i]) < RT_DT_SIG_MIN)
+                continue;
             char tmpstr[256];
-            rt_dt_sprintf(tmpstr, p);
-            fprintf(fd, " %s  %s\n", (i++ == 0) ? " " : "+", tmpstr);
-        } while (p->next != hd);
+            rt_dt_sprintf(tmpstr, &rt_dt_table.routes[bp->idx[i]]);
+            fprintf(fd, " %s  %s\n", (j++ == 0) ? " " : "+", tmpstr);
+        }
+    }
+    fprintf(fd, "\n");
+    fflush(fd);
+}
+
+/*
+ * Print the bucket occupancy distribution and how many entries had
+ * to use their alternate bucket.
+ */
+void
+rt_dt_histogram (FILE *fd)
+{
+    uint64_t hist[RT_DT_BUCKET_ENTRIES + 1];
+    uint64_t used = 0, alt = 0;
+    uint32_t bidx;
+    int i;
+
+    memset(hist, 0, sizeof(hist));
+    for (bidx = 0 ; bidx <= rt_dt_table.bucket_mask ; bidx++) {
+        const rt_dt_bucket_t *bp = &rt_dt_table.buckets[bidx];
+        int cnt = 0;
+        for (i = 0 ; i < RT_DT_BUCKET_ENTRIES ; i++) {
+            if (rt_rcu_dereference(bp->sig[i]) < RT_DT_SIG_MIN)
+                continue;
+            cnt++;
+            const rt_dt_route_t *rp = &rt_dt_table.routes[bp->idx[i]];
+            if (rt_dt_bucket_prim(rt_dt_hash(&rp->key)) != bidx)
+                alt++;
+        }
+        hist[cnt]++;
+        used += cnt;
+    }
+
+    uint32_t bcnt = rt_dt_table.bucket_mask + 1;
+    fprintf(fd, "DT: %"PRIu64"/%u entries (%.1f%%), alternate: %"PRIu64
+        ", insert failures: %"PRIu64"\n",
+        used, rt_dt_table.route_count,
+        100.0 * (double) used / (double) rt_dt_table.route_count,
+        alt, rt_dt_table.insert_fail);
+    fprintf(fd, "DT bucket occupancy:");
+    for (i = 0 ; i <= RT_DT_BUCKET_ENTRIES ; i++) {
+        fprintf(fd, "  %d: %.1f%%", i,
+            100.0 * (double) hist[i] / (double) bcnt);
     }
     fprintf(fd, "\n");
     fflush(fd);
@@ -175,54 +610,236 @@ rt_dt_dump (FILE *fd)
 /**********************************************************************/
 /*  Route Table (LPM)  */
 
+/*
+ * The route entries are kept in a sorted linear list (for dumping and
+ * walking), but lookups go through a DIR-24-8 table per routing domain.
+ * The first level (tbl24) is indexed by the top 24 bits of the address.
+ * Prefixes longer than 24 bits expand into a 256-entry tbl8 group.
+ * Each table entry holds the prefix length (depth) and an index into
+ * 'rt_lpm_route_index'. Entries are only ever added, never removed.
+ */
+
+#define RT_LPM_E_VALID          (1U << 31)
+#define RT_LPM_E_GROUP          (1U << 30)
+#define RT_LPM_E_DEPTH_SHIFT    24
+#define RT_LPM_E_DEPTH_MASK     (0x3f)
+#define RT_LPM_E_INDEX_MASK     (0xffffff)
+
+#define RT_LPM_TBL24_SIZE       (1 << 24)
+#define RT_LPM_TBL8_SIZE        256
+
+typedef struct {
+    uint32_t *tbl24;
+    uint32_t *tbl8;
+    uint32_t tbl8_count;
+} rt_lpm_dir_t;
+
+/* Per Routing Domain Tables */
+typedef struct {
+    rt_lpm_dir_t all;
+    rt_lpm_dir_t subnet;
+} rt_lpm_rd_table_t;
+
 static rt_lpm_t rt_db_home;
 static sem_t rt_lpm_lock;
 
+static rt_lpm_rd_table_t **rt_lpm_rd_table;
+static rt_lpm_t **rt_lpm_route_index;
+static uint32_t rt_lpm_route_count;
+
 static inline uint32_t
 rt_ipv4_mask (int plen)
 {
     return ((uint64_t) 0xffffffff) << (32 - plen);
 }
 
-rt_lpm_t *
-rt_lpm_lookup (rt_rd_t rdidx, rt_ipv4_addr_t addr)
+static inline uint32_t
+rt_lpm_entry (int depth, uint32_t lpmidx)
 {
-    rt_lpm_t *p;
+    return RT_LPM_E_VALID | (depth << RT_LPM_E_DEPTH_SHIFT) | lpmidx;
+}
 
-    for (p = rt_db_home.prev ; p != &rt_db_home ; p = p->prev) {
-        if (p->rdidx != rdidx)
-            continue;
-        if ( ( (addr ^ p->prefix.addr ) & rt_ipv4_mask(p->prefix.len) ) == 0 ) {
-            return p;
-        }
+static inline int
+rt_lpm_entry_depth (uint32_t e)
+{
+    return (e >> RT_LPM_E_DEPTH_SHIFT) & RT_LPM_E_DEPTH_MASK;
+}
+
+static inline uint32_t
+rt_lpm_dir_lookup (const rt_lpm_dir_t *dir, rt_ipv4_addr_t addr)
+{
+    uint32_t e = dir->tbl24[addr >> 8];
+    if (unlikely(e & RT_LPM_E_GROUP)) {
+        uint32_t grpidx = e & RT_LPM_E_INDEX_MASK;
+        e = dir->tbl8[grpidx * RT_LPM_TBL8_SIZE + (addr & 0xff)];
     }
+    return e;
+}
+
+static inline rt_lpm_t *
+rt_lpm_entry_route (uint32_t e)
+{
+    if (e & RT_LPM_E_VALID)
+        return rt_lpm_route_index[e & RT_LPM_E_INDEX_MASK];
     return NULL;
 }
 
-rt_lpm_t *
-rt_lpm_lookup_subnet (rt_rd_t rdidx, rt_ipv4_addr_t addr)
+static void
+rt_lpm_dir_init (rt_lpm_dir_t *dir, rt_rd_t rdidx, const char *kind)
 {
-    rt_lpm_t *p;
+    char name[32];
+    snprintf(name, sizeof(name), "LPM %u %s tbl24", rdidx, kind);
+    dir->tbl24 = (uint32_t *) rt_numa_lazy_alloc(name,
+        RT_LPM_TBL24_SIZE * sizeof(uint32_t));
+    snprintf(name, sizeof(name), "LPM %u %s tbl8", rdidx, kind);
+    dir->tbl8 = (uint32_t *) rt_numa_lazy_alloc(name,
+        RT_LPM_TBL8_GROUPS * RT_LPM_TBL8_SIZE * sizeof(uint32_t));
+    dir->tbl8_count = 0;
+}
 
-    for (p = rt_db_home.prev ; p != &rt_db_home ; p = p->prev) {
-        if (p->rdidx != rdidx)
-            continue;
-        if ((p->flags & RT_LPM_F_SUBNET) == 0)
+/*
+ * Overwrite a range of entries unless they already belong to a
+ * longer (more specific) prefix.
+ */
+static inline void
+rt_lpm_dir_fill (uint32_t *tbl, uint32_t count, int depth, uint32_t e)
+{
+    uint32_t i;
+    for (i = 0 ; i < count ; i++) {
+        uint32_t o = tbl[i];
+        if ((o & RT_LPM_E_VALID) && (rt_lpm_entry_depth(o) > depth))
             continue;
-        if ( ( (addr ^ p->prefix.addr ) & rt_ipv4_mask(p->prefix.len) ) == 0 ) {
-            return p;
+        tbl[i] = e;
+    }
+}
+
+static int
+rt_lpm_dir_insert (rt_lpm_dir_t *dir, rt_ipv4_prefix_t prefix,
+    uint32_t lpmidx)
+{
+    int depth = prefix.len;
+    rt_ipv4_addr_t addr = prefix.addr & rt_ipv4_mask(depth);
+    uint32_t e = rt_lpm_entry(depth, lpmidx);
+
+    if (depth <= 24) {
+        uint32_t first = addr >> 8;
+        uint32_t count = 1 << (24 - depth);
+        uint32_t i;
+        for (i = first ; i < first + count ; i++) {
+            uint32_t o = dir->tbl24[i];
+            if (o & RT_LPM_E_GROUP) {
+                uint32_t grpidx = o & RT_LPM_E_INDEX_MASK;
+                rt_lpm_dir_fill(&dir->tbl8[grpidx * RT_LPM_TBL8_SIZE],
+                    RT_LPM_TBL8_SIZE, depth, e);
+            } else {
+                rt_lpm_dir_fill(&dir->tbl24[i], 1, depth, e);
+            }
         }
+        return 0;
+    }
+
+    uint32_t *tp = &dir->tbl24[addr >> 8];
+    uint32_t grpidx;
+    if (*tp & RT_LPM_E_GROUP) {
+        grpidx = *tp & RT_LPM_E_INDEX_MASK;
+    } else {
+        if (dir->tbl8_count >= RT_LPM_TBL8_GROUPS)
+            return -1;
+        grpidx = dir->tbl8_count++;
+        /* Populate the new group with the covering entry */
+        uint32_t *gp = &dir->tbl8[grpidx * RT_LPM_TBL8_SIZE];
+        int i;
+        for (i = 0 ; i < RT_LPM_TBL8_SIZE ; i++)
+            gp[i] = *tp;
+        /* Make group visible to readers before linking it */
+        rte_smp_wmb();
+        *tp = RT_LPM_E_GROUP | grpidx;
+    }
+    rt_lpm_dir_fill(&dir->tbl8[grpidx * RT_LPM_TBL8_SIZE + (addr & 0xff)],
+        1 << (32 - depth), depth, e);
+    return 0;
+}
+
+static rt_lpm_rd_table_t *
+rt_lpm_rd_table_get (rt_rd_t rdidx)
+{
+    rt_lpm_rd_table_t *rdt = rt_lpm_rd_table[rdidx];
+    if (rdt == NULL) {
+        rdt = (rt_lpm_rd_table_t *)
+            rt_numa_entry_alloc(sizeof(rt_lpm_rd_table_t));
+        rt_lpm_dir_init(&rdt->all, rdidx, "all");
+        rt_lpm_dir_init(&rdt->subnet, rdidx, "subnet");
+        rte_smp_wmb();
+        rt_lpm_rd_table[rdidx] = rdt;
+    }
+    return rdt;
+}
+
+/*
+ * Add route to the DIR-24-8 table(s) of its routing domain.
+ * Must be called with 'rt_lpm_lock' held.
+ */
+static void
+rt_lpm_index_add (rt_lpm_t *rt, int subnet)
+{
+    rt_lpm_rd_table_t *rdt = rt_lpm_rd_table_get(rt->rdidx);
+    rt_lpm_dir_t *dir = (subnet) ? &rdt->subnet : &rdt->all;
+    /* Publish route pointer before it becomes reachable */
+    rte_smp_wmb();
+    int rc = rt_lpm_dir_insert(dir, rt->prefix, rt->lpmidx);
+    if (rc < 0) {
+        char ts[64];
+        dbgmsg(ERROR, nopkt, "LPM table full - can not index (%u) %s",
+            rt->rdidx, rt_prefix_str(ts, rt->prefix));
     }
-    return NULL;
+}
+
+rt_lpm_t *
+rt_lpm_lookup (rt_rd_t rdidx, rt_ipv4_addr_t addr)
+{
+    const rt_lpm_rd_table_t *rdt = rt_lpm_rd_table[rdidx];
+    if (unlikely(rdt == NULL))
+        return NULL;
+    return rt_lpm_entry_route(rt_lpm_dir_lookup(&rdt->all, addr));
+}
+
+/*
+ * Look up a burst of addresses. The first-level entries are
+ * prefetched for the whole burst before any of them is resolved.
+ */
+void
+rt_lpm_lookup_bulk (rt_rd_t rdidx, const rt_ipv4_addr_t *addrs,
+    rt_lpm_t **rts, int count)
+{
+    const rt_lpm_rd_table_t *rdt = rt_lpm_rd_table[rdidx];
+    int i;
+    if (unlikely(rdt == NULL)) {
+        for (i = 0 ; i < count ; i++)
+            rts[i] = NULL;
+        return;
+    }
+    const rt_lpm_dir_t *dir = &rdt->all;
+    for (i = 0 ; i < count ; i++)
+        rte_prefetch0(&dir->tbl24[addrs[i] >> 8]);
+    for (i = 0 ; i < count ; i++)
+        rts[i] = rt_lpm_entry_route(rt_lpm_dir_lookup(dir, addrs[i]));
+}
+
+rt_lpm_t *
+rt_lpm_lookup_subnet (rt_rd_t rdidx, rt_ipv4_addr_t addr)
+{
+    const rt_lpm_rd_table_t *rdt = rt_lpm_rd_table[rdidx];
+    if (rdt == NULL)
+        return NULL;
+    return rt_lpm_entry_route(rt_lpm_dir_lookup(&rdt->subnet, addr));
 }
 
 rt_lpm_t *
 rt_lpm_find_or_create (rt_rd_t rdidx, rt_ipv4_prefix_t prefix,
     rt_port_info_t *pi)
 {
-    rt_lpm_t *ne = (rt_lpm_t *) malloc(sizeof(rt_lpm_t));
-    assert(ne != NULL);
-    memset(ne, 0, sizeof(rt_lpm_t));
+    rt_lpm_t *ne = (rt_lpm_t *) rt_numa_entry_alloc(sizeof(rt_lpm_t));
+    ne->dt_head = RT_DT_IDX_NONE;
     char ts0[64], ts1[32];
     dbgmsg(INFO, nopkt, "Adding LPM route for (%d) %s -> port %s",
         rdidx, rt_prefix_str(ts0, prefix),
@@ -233,26 +850,57 @@ rt_lpm_find_or_create (rt_rd_t rdidx, rt_ipv4_prefix_t prefix,
         ne->pi = pi;
         ne->flags |= RT_LPM_F_HAS_PORTINFO;
     }
-    rt_lpm_t *p;
+    rt_lpm_t *p, *cover = NULL, *updated = NULL;
     sem_wait(&rt_lpm_lock);
     for (p = rt_db_home.next ;  ; p = p->next) {
         if ((p->rdidx == rdidx) && (p->prefix.addr == prefix.addr)
                 && (p->prefix.len == prefix.len)) {
             p->pi = pi;
             p->flags |= RT_LPM_F_HAS_PORTINFO;
-            free(ne);
+            rt_numa_free(ne);
             ne = p;
+            updated = p;
             break;
         }
         if ((p == &rt_db_home) || (prefix.len < p->prefix.len)) {
+            if (rt_lpm_route_count >= RT_LPM_MAX_ROUTES) {
+                dbgmsg(ERROR, nopkt, "LPM route limit (%u) reached",
+                    RT_LPM_MAX_ROUTES);
+                rt_numa_free(ne);
+                ne = NULL;
+                break;
+            }
+            ne->lpmidx = rt_lpm_route_count++;
+            rt_lpm_route_index[ne->lpmidx] = ne;
+            char name[80];
+            snprintf(name, sizeof(name), "(%d) %s", rdidx, ts0);
+            ne->cntidx = rt_cnt_alloc(RT_CNT_K_ROUTE, name);
             ne->next = p;
             ne->prev = p->prev;
             p->prev->next = ne;
             p->prev = ne;
+            rt_lpm_index_add(ne, 0);
             break;
         }
+        /* The list is sorted by length: the last shorter route that
+         * contains the prefix is the one it takes addresses from */
+        if ((p->rdidx == rdidx) && (p->prefix.len < prefix.len)
+                && rt_prefix_match(&p->prefix, prefix.addr))
+            cover = p;
     }
     sem_post(&rt_lpm_lock);
+
+    /* Cached forwarding decisions that no longer hold */
+    if (updated != NULL) {
+        rt_dt_invalidate_route(updated, NULL);
+    }
+    if ((ne != NULL) && (updated == NULL) && (cover != NULL)) {
+        char ts2[64];
+        int cnt = rt_dt_invalidate_route(cover, &prefix);
+        dbgmsg(INFO, nopkt, "(%d) %s covered by %s: %d DT entries"
+            " invalidated", rdidx, ts0, rt_prefix_str(ts2, cover->prefix),
+            cnt);
+    }
     return ne;
 }
 
@@ -276,6 +924,7 @@ rt_lpm_route_create (rt_rd_t rdidx, rt_ipv4_addr_t ipaddr, int plen,
     rt->pi = srp->pi;
     rt->nh_rdidx = nh_rdidx;
     rt->flags |= flags;
+    rt_dt_invalidate_route(rt, NULL);
     return rt;
 }
 
@@ -306,9 +955,15 @@ rt_lpm_add_iface_addr (rt_port_info_t *pi,
         /* Add a route to the LPM for the subnet */
         rt_lpm_t *srt = rt_lpm_find_or_create(pi->rdidx, prefix, pi);
         assert(srt != NULL);
-        srt->flags |= RT_LPM_F_SUBNET;
         /* Add local IP address to route entry */
         srt->ifipa = ipaddr;
+        sem_wait(&rt_lpm_lock);
+        if ((srt->flags & RT_LPM_F_SUBNET) == 0) {
+            srt->flags |= RT_LPM_F_SUBNET;
+            rt_lpm_index_add(srt, 1);
+        }
+        sem_post(&rt_lpm_lock);
+        rt_dt_invalidate_route(srt, NULL);
     }
 }
 
@@ -332,6 +987,12 @@ rt_lpm_table_init (void)
 {
     rt_db_home.prev = &rt_db_home;
     rt_db_home.next = &rt_db_home;
+    rt_lpm_rd_table = (rt_lpm_rd_table_t **)
+        rt_numa_table_alloc("LPM domains", (1 << 16) * sizeof(void *));
+    rt_lpm_route_index = (rt_lpm_t **)
+        rt_numa_lazy_alloc("LPM route index",
+            RT_LPM_MAX_ROUTES * sizeof(rt_lpm_t *));
+    rt_lpm_route_count = 0;
     int rc = sem_init(&rt_lpm_lock, 1, 1);
     assert(rc == 0);
 }
@@ -394,7 +1055,27 @@ rt_lpm_gen_icmp_requests (void)
 
 static sem_t rt_ipv4_ar_lock;
 
-static rt_ipv4_ar_t rt_ipv4_ar_table[RT_IPV4_AR_TABLE_SIZE];
+static rt_ipv4_ar_t *rt_ipv4_ar_table;
+
+/*
+ * Aging timer wheel. Forwarding lcores only (re)arm entries when they
+ * learn an address or queue the first packet for an unresolved one;
+ * expiry processing, refresh requests, pending queue timeouts and DT
+ * invalidation run on the housekeeping thread (rt_ipv4_ar_timer_run).
+ */
+#define RT_AR_TW_RUNNING        UINT64_MAX
+#define RT_AR_TW_RERUN          (UINT64_MAX - 1)
+
+static rt_ipv4_ar_t *rt_ar_tw[RT_AR_TW_SLOTS];
+static uint64_t rt_ar_tw_now;       /* Last processed tick */
+static uint64_t rt_ar_tw_cycles;    /* Timer cycles per tick */
+static rte_spinlock_t rt_ar_tw_lock;
+
+static inline uint64_t
+rt_ar_cycles_to_ticks (uint64_t cycles)
+{
+    return (cycles + rt_ar_tw_cycles - 1) / rt_ar_tw_cycles;
+}
 
 static inline int rt_ipv4_art_hash (rt_port_info_t *pi, rt_ipv4_addr_t ipaddr)
 {
@@ -405,6 +1086,12 @@ void rt_ar_table_init (void)
 {
     int rc = sem_init(&rt_ipv4_ar_lock, 1, 1);
     assert(rc == 0);
+    memset(rt_ar_tw, 0, sizeof(rt_ar_tw));
+    rt_ar_tw_cycles = rte_get_timer_hz() / 1000 * RT_AR_TW_TICK_MS;
+    rt_ar_tw_now = rte_get_timer_cycles() / rt_ar_tw_cycles + 1;
+    rte_spinlock_init(&rt_ar_tw_lock);
+    rt_ipv4_ar_table = (rt_ipv4_ar_t *) rt_numa_table_alloc("ARP table",
+        RT_IPV4_AR_TABLE_SIZE * sizeof(rt_ipv4_ar_t));
     int idx;
     for (idx = 0 ; idx < RT_IPV4_AR_TABLE_SIZE ; idx++)
     {
@@ -412,6 +1099,8 @@ void rt_ar_table_init (void)
         memset(p, 0, sizeof(rt_ipv4_ar_t));
         p->pi = NULL;
         p->prev = p->next = p;
+        rte_spinlock_init(&p->pend_lock);
+        p->dt_head = RT_DT_IDX_NONE;
     }
 }
 
@@ -430,13 +1119,13 @@ rt_ipv4_ar_lookup (rt_port_info_t *pi, rt_ipv4_addr_t ipaddr)
     return NULL;
 }
 
+/*
+ * Readers (rt_ipv4_ar_lookup) walk the lists without the lock: an
+ * entry is filled in before it is linked, and a reused list head gets
+ * its address before its port.
+ */
 rt_ipv4_ar_t *rt_ipv4_ar_find_or_create (rt_port_info_t *pi, rt_ipv4_addr_t ipaddr)
 {
-    /* Allocate new entry (just in case) */
-    rt_ipv4_ar_t *ap = (rt_ipv4_ar_t *) malloc(sizeof(rt_ipv4_ar_t));
-    assert(ap != NULL);
-    memset(ap, 0, sizeof(rt_ipv4_ar_t));
-
     int idx = rt_ipv4_art_hash(pi, ipaddr);
     rt_ipv4_ar_t *hd = &rt_ipv4_ar_table[idx];
     rt_ipv4_ar_t *sp;
@@ -448,59 +1137,356 @@ rt_ipv4_ar_t *rt_ipv4_ar_find_or_create (rt_port_info_t *pi, rt_ipv4_addr_t ipad
         if (sp->next == hd) {
             if (hd->pi == NULL) {
                 sp = hd;
+                sp->flags = 0;
+                sp->ipaddr = ipaddr;
+                __atomic_store_n(&sp->pi, pi, __ATOMIC_RELEASE);
             } else {
-                /* Insert 'ap' at end of list */
-                ap->next = hd;
-                ap->prev = hd->prev;
-                hd->prev->next = ap;
-                hd->prev = ap;
-                sp = ap;
-                ap = NULL;
+                /* Insert a new entry at end of list */
+                sp = (rt_ipv4_ar_t *)
+                    rt_numa_entry_alloc(sizeof(rt_ipv4_ar_t));
+                rte_spinlock_init(&sp->pend_lock);
+                sp->dt_head = RT_DT_IDX_NONE;
+                sp->pi = pi;
+                sp->ipaddr = ipaddr;
+                sp->flags = 0;
+                sp->next = hd;
+                sp->prev = hd->prev;
+                __atomic_store_n(&hd->prev->next, sp, __ATOMIC_RELEASE);
+                hd->prev = sp;
             }
-            sp->pi = pi;
-            sp->ipaddr = ipaddr;
-            sp->flags = 0;
             break;
         }
     }
     sem_post(&rt_ipv4_ar_lock);
 
-
-    /* If the ap was not used (ap != NULL), then relase it */
-    free(ap);
-
     return sp;
 }
 
-int rt_ipv4_ar_get_pkt (rt_pkt_t *pkt, rt_ipv4_ar_t *ar)
+/*
+ * Dequeue up to 'count' pending packets. Returns the number dequeued.
+ */
+int rt_ipv4_ar_get_pkts (rt_ipv4_ar_t *ar, rt_pkt_t *pkts, int count)
 {
-    if (ar == NULL)
+    if ((ar == NULL) || (ar->pend_cnt == 0))
         return 0;
-    int got_pkt = 0;
-    sem_wait(&rt_ipv4_ar_lock);
-    if (ar->flags & RT_AR_F_HAS_PKT) {
-        memcpy(pkt, &ar->pkt, sizeof(rt_pkt_t));
-        ar->flags &= ~RT_AR_F_HAS_PKT;
-        memset(&ar->pkt, 0, sizeof(rt_pkt_t));
-        got_pkt = 1;
+    int depth = g.ar_queue_depth;
+    int n = 0;
+    rte_spinlock_lock(&ar->pend_lock);
+    while ((n < count) && (ar->pend_cnt > 0)) {
+        pkts[n++] = ar->pend[ar->pend_head];
+        ar->pend_head = (ar->pend_head + 1) % depth;
+        ar->pend_cnt--;
     }
-    sem_post(&rt_ipv4_ar_lock);
-    return got_pkt;
+    rte_spinlock_unlock(&ar->pend_lock);
+    return n;
 }
 
+static void rt_ar_tw_schedule (rt_ipv4_ar_t *ar, uint64_t ticks);
+
+/*
+ * Claim the right to send a request for the entry: at most one per
+ * RT_AR_PROBE_TICKS (less a tick of timer jitter), whether it comes
+ * from the forwarding path or the aging timer.
+ */
+int
+rt_ipv4_ar_request_due (rt_ipv4_ar_t *ar, uint64_t now)
+{
+    uint64_t gap = (RT_AR_PROBE_TICKS - 1) * rt_ar_tw_cycles;
+    uint64_t last = __atomic_load_n(&ar->requested, __ATOMIC_RELAXED);
+    if ((last != 0) && (now - last < gap))
+        return 0;
+    return __atomic_compare_exchange_n(&ar->requested, &last, now, 0,
+        __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+/*
+ * Queue a packet until the address is resolved. Returns the number of
+ * pending packets including this one, or 0 if the queue is full (the
+ * caller still owns the packet). The first packet arms the entry's
+ * timer, which repeats the request and times the queue out.
+ */
 int rt_ipv4_ar_set_pkt (rt_pkt_t pkt, rt_ipv4_ar_t *ar)
 {
     if (ar == NULL)
         return 0;
-    int added_pkt = 0;
+    int depth = g.ar_queue_depth;
+    int qlen = 0;
+    rte_spinlock_lock(&ar->pend_lock);
+    if (ar->pend == NULL) {
+        ar->pend = (rt_pkt_t *) rt_numa_entry_alloc(depth * sizeof(rt_pkt_t));
+        ar->pend_head = 0;
+        ar->pend_cnt = 0;
+    }
+    if (ar->pend_cnt < depth) {
+        if (ar->pend_cnt == 0)
+            ar->pend_since = rte_get_timer_cycles();
+        ar->pend[(ar->pend_head + ar->pend_cnt) % depth] = pkt;
+        qlen = ++ar->pend_cnt;
+    } else {
+        ar->pend_drop++;
+    }
+    rte_spinlock_unlock(&ar->pend_lock);
+    if (qlen == 1)
+        rt_ar_tw_schedule(ar, RT_AR_PROBE_TICKS);
+    return qlen;
+}
+
+/*
+ * Discard the pending packets of an entry whose address was not
+ * resolved in time, and release the queue. Returns the ticks until
+ * the queue times out (0: nothing queued or discarded).
+ */
+static uint64_t
+rt_ipv4_ar_pend_expire (rt_ipv4_ar_t *ar, uint64_t now)
+{
+    uint64_t timeout = RT_AR_PEND_TIMEOUT_TICKS * rt_ar_tw_cycles;
+    rt_pkt_t *pend = NULL;
+    uint16_t head = 0, cnt = 0;
+    uint64_t next = 0;
+    int depth = g.ar_queue_depth;
+
+    rte_spinlock_lock(&ar->pend_lock);
+    if (ar->pend_cnt > 0) {
+        uint64_t age = now - ar->pend_since;
+        if (age < timeout) {
+            next = rt_ar_cycles_to_ticks(timeout - age);
+        } else {
+            pend = ar->pend;
+            head = ar->pend_head;
+            cnt = ar->pend_cnt;
+            ar->pend = NULL;
+            ar->pend_cnt = 0;
+        }
+    }
+    rte_spinlock_unlock(&ar->pend_lock);
+
+    if (pend != NULL) {
+        char ts[32];
+        dbgmsg(INFO, nopkt, "ARP (p%u) %s unresolved, %u queued packet(s)"
+            " discarded", ar->pi->idx, rt_ipaddr_str(ts, ar->ipaddr), cnt);
+        while (cnt-- > 0) {
+            rt_pkt_discard(pend[head], RT_DISC_ARPQ);
+            head = (head + 1) % depth;
+        }
+        rt_numa_free(pend);
+    }
+    return next;
+}
+
+/* Refresh requests start at 3/4 of the reachable time */
+static inline uint64_t
+rt_ar_refresh_cycles (void)
+{
+    uint64_t reachable = g.ar_reachable * rte_get_timer_hz();
+    return reachable - reachable / 4;
+}
+
+/* Must be called with 'rt_ar_tw_lock' held */
+static void
+rt_ar_tw_link (rt_ipv4_ar_t *ar, uint64_t expire)
+{
+    rt_ipv4_ar_t **hd = &rt_ar_tw[expire % RT_AR_TW_SLOTS];
+    ar->tw_expire = expire;
+    ar->tw_prev = NULL;
+    ar->tw_next = *hd;
+    if (*hd != NULL)
+        (*hd)->tw_prev = ar;
+    *hd = ar;
+}
+
+/* Must be called with 'rt_ar_tw_lock' held */
+static void
+rt_ar_tw_unlink (rt_ipv4_ar_t *ar)
+{
+    if (ar->tw_prev != NULL)
+        ar->tw_prev->tw_next = ar->tw_next;
+    else
+        rt_ar_tw[ar->tw_expire % RT_AR_TW_SLOTS] = ar->tw_next;
+    if (ar->tw_next != NULL)
+        ar->tw_next->tw_prev = ar->tw_prev;
+    ar->tw_prev = ar->tw_next = NULL;
+    ar->tw_expire = 0;
+}
+
+/*
+ * Make sure the entry's timer fires within 'ticks'. An entry whose
+ * handler is running right now is marked to run again on the next
+ * tick, so that it sees the new state.
+ */
+static void
+rt_ar_tw_schedule (rt_ipv4_ar_t *ar, uint64_t ticks)
+{
+    rte_spinlock_lock(&rt_ar_tw_lock);
+    uint64_t expire = rt_ar_tw_now + RTE_MAX(ticks, (uint64_t) 1);
+    if (ar->tw_expire >= RT_AR_TW_RERUN) {
+        ar->tw_expire = RT_AR_TW_RERUN;
+    } else {
+        if (ar->tw_expire == 0) {
+            rt_ar_tw_link(ar, expire);
+        } else if (expire < ar->tw_expire) {
+            rt_ar_tw_unlink(ar);
+            rt_ar_tw_link(ar, expire);
+        }
+    }
+    rte_spinlock_unlock(&rt_ar_tw_lock);
+}
+
+/*
+ * Re-arm an entry after its handler ran ('ticks' 0: stop the timer)
+ */
+static void
+rt_ar_tw_rearm (rt_ipv4_ar_t *ar, uint64_t ticks)
+{
+    rte_spinlock_lock(&rt_ar_tw_lock);
+    assert(ar->tw_expire >= RT_AR_TW_RERUN);
+    if (ar->tw_expire == RT_AR_TW_RERUN)
+        ticks = 1;
+    ar->tw_expire = 0;
+    if (ticks > 0)
+        rt_ar_tw_link(ar, rt_ar_tw_now + ticks);
+    rte_spinlock_unlock(&rt_ar_tw_lock);
+}
+
+/*
+ * Advance the wheel to 'tick' and return the expired entries, chained
+ * through 'tw_next' and marked as running.
+ */
+static rt_ipv4_ar_t *
+rt_ar_tw_advance (uint64_t tick)
+{
+    rt_ipv4_ar_t *expired = NULL;
+    rte_spinlock_lock(&rt_ar_tw_lock);
+    if (tick > rt_ar_tw_now) {
+        uint64_t n = RTE_MIN(tick - rt_ar_tw_now, (uint64_t) RT_AR_TW_SLOTS);
+        uint64_t t;
+        for (t = rt_ar_tw_now + 1 ; n-- > 0 ; t++) {
+            rt_ipv4_ar_t *ar = rt_ar_tw[t % RT_AR_TW_SLOTS];
+            while (ar != NULL) {
+                rt_ipv4_ar_t *next = ar->tw_next;
+                if (ar->tw_expire <= tick) {
+                    rt_ar_tw_unlink(ar);
+                    ar->tw_expire = RT_AR_TW_RUNNING;
+                    ar->tw_next = expired;
+                    expired = ar;
+                }
+                ar = next;
+            }
+        }
+        rt_ar_tw_now = tick;
+    }
+    rte_spinlock_unlock(&rt_ar_tw_lock);
+    return expired;
+}
+
+/*
+ * Aging state machine of one entry. Returns the ticks until the next
+ * run (0: no timer needed until the address is learned again).
+ *
+ *   age < 3/4 reachable          nothing to do
+ *   age < reachable + stale      send refresh requests (STALE once
+ *                                past reachable, still forwarding)
+ *   otherwise                    forget the address
+ *
+ * While packets are queued for an unresolved address the request is
+ * repeated every RT_AR_PROBE_TICKS, until the queue times out.
+ */
+static uint64_t
+rt_ipv4_ar_age (rt_ipv4_ar_t *ar, uint64_t now, int *budget)
+{
+    uint64_t hz = rte_get_timer_hz();
+    uint64_t reachable = g.ar_reachable * hz;
+    uint64_t lifetime = reachable + g.ar_stale * hz;
+    uint64_t refresh = rt_ar_refresh_cycles();
+    rt_eth_addr_t prev_hwaddr, hwaddr;
+    int changed = 0, expired = 0, stale = 0, probe = 0;
+    uint64_t next = 0;
+    char ts0[32], ts1[32], ts2[32];
+
     sem_wait(&rt_ipv4_ar_lock);
-    if ((ar->flags & RT_AR_F_HAS_PKT) == 0) {
-        memcpy(&ar->pkt, &pkt, sizeof(rt_pkt_t));
-        ar->flags |= RT_AR_F_HAS_PKT;
-        added_pkt = 1;
+    if (ar->flags & RT_AR_F_HW_CHANGED) {
+        memcpy(prev_hwaddr, ar->prev_hwaddr, sizeof(rt_eth_addr_t));
+        ar->flags &= ~RT_AR_F_HW_CHANGED;
+        changed = 1;
     }
+    memcpy(hwaddr, ar->hwaddr, sizeof(rt_eth_addr_t));
+    if ((ar->flags & (RT_AR_F_HAS_HWADDR | RT_AR_F_STATIC))
+            == RT_AR_F_HAS_HWADDR) {
+        uint64_t age = now - ar->confirmed;
+        if (age < refresh) {
+            next = rt_ar_cycles_to_ticks(refresh - age);
+        } else if (age >= lifetime) {
+            ar->flags &= ~(RT_AR_F_HAS_HWADDR | RT_AR_F_STALE);
+            expired = 1;
+        } else {
+            if ((age >= reachable) && !(ar->flags & RT_AR_F_STALE)) {
+                ar->flags |= RT_AR_F_STALE;
+                stale = 1;
+            }
+            probe = 1;
+            next = RT_AR_PROBE_TICKS;
+        }
+    }
+    int resolved = (ar->flags & RT_AR_F_HAS_HWADDR) != 0;
     sem_post(&rt_ipv4_ar_lock);
-    return added_pkt;
+
+    /* A packet may also have been queued just as the address arrived */
+    uint64_t pend = rt_ipv4_ar_pend_expire(ar, now);
+    if (pend > 0) {
+        if (!resolved) {
+            probe = 1;
+            pend = RTE_MIN(pend, (uint64_t) RT_AR_PROBE_TICKS);
+        }
+        next = (next == 0) ? pend : RTE_MIN(next, pend);
+    }
+
+    if (changed) {
+        int cnt = rt_dt_invalidate_ar(ar);
+        dbgmsg(INFO, nopkt, "ARP (p%u) %s moved from %s to %s"
+            " (%d DT entries invalidated)", ar->pi->idx,
+            rt_ipaddr_str(ts2, ar->ipaddr), rt_hwaddr_str(ts0, prev_hwaddr),
+            rt_hwaddr_str(ts1, hwaddr), cnt);
+    }
+    if (expired) {
+        int cnt = rt_dt_invalidate_ar(ar);
+        dbgmsg(INFO, nopkt, "ARP (p%u) %s expired after %u request(s)"
+            " (%d DT entries invalidated)", ar->pi->idx,
+            rt_ipaddr_str(ts2, ar->ipaddr), ar->probes, cnt);
+    }
+    if (stale) {
+        dbgmsg(DEBUG, nopkt, "ARP (p%u) %s is stale", ar->pi->idx,
+            rt_ipaddr_str(ts2, ar->ipaddr));
+    }
+    if (probe) {
+        if (*budget > 0) {
+            /* Skipped if the forwarding path asked just now */
+            if (rt_ipv4_ar_request_due(ar, now)) {
+                (*budget)--;
+                ar->probes++;
+                rt_arp_request(ar->pi, ar->ipaddr);
+            }
+        } else {
+            /* Over the per-tick request limit - retry next tick */
+            next = 1;
+        }
+    }
+    return next;
+}
+
+/*
+ * Run expired aging timers. Called by the housekeeping thread once
+ * per tick, never on the forwarding lcores.
+ */
+void
+rt_ipv4_ar_timer_run (void)
+{
+    uint64_t now = rte_get_timer_cycles();
+    rt_ipv4_ar_t *ar = rt_ar_tw_advance(now / rt_ar_tw_cycles);
+    int budget = RT_AR_PROBES_PER_TICK;
+    while (ar != NULL) {
+        rt_ipv4_ar_t *next = ar->tw_next;
+        rt_ar_tw_rearm(ar, rt_ipv4_ar_age(ar, now, &budget));
+        ar = next;
+    }
 }
 
 rt_ipv4_ar_t *
@@ -512,18 +1498,35 @@ rt_ipv4_ar_learn (rt_port_info_t *pi, rt_ipv4_addr_t ipaddr,
 
     sem_wait(&rt_ipv4_ar_lock);
 
+    /* Remember the old address for DT invalidation */
+    if ((sp->flags & RT_AR_F_HAS_HWADDR)
+            && !(sp->flags & RT_AR_F_HW_CHANGED)
+            && (memcmp(sp->hwaddr, hwaddr, sizeof(rt_eth_addr_t)) != 0)) {
+        memcpy(sp->prev_hwaddr, sp->hwaddr, sizeof(rt_eth_addr_t));
+        sp->flags |= RT_AR_F_HW_CHANGED;
+    }
     memcpy(sp->hwaddr, hwaddr, sizeof(rt_eth_addr_t));
     sp->flags |= RT_AR_F_HAS_HWADDR;
+    sp->flags &= ~RT_AR_F_STALE;
+    sp->confirmed = rte_get_timer_cycles();
+    sp->probes = 0;
+    uint32_t flags = sp->flags;
 
     sem_post(&rt_ipv4_ar_lock);
 
+    if (flags & RT_AR_F_HW_CHANGED) {
+        rt_ar_tw_schedule(sp, 1);
+    } else if (!(flags & RT_AR_F_STATIC)) {
+        rt_ar_tw_schedule(sp, rt_ar_cycles_to_ticks(rt_ar_refresh_cycles()));
+    }
+
     return sp;
 }
 
 /**********************************************************************/
 /*  Local Address Table */
 
-static rt_lat_t rt_lat_table[RT_LAR_TABLE_SIZE];
+static rt_lat_t *rt_lat_table;
 
 static inline int rt_lat_db_hash (rt_port_info_t *pi, rt_ipv4_addr_t ipaddr)
 {
@@ -532,6 +1535,8 @@ static inline int rt_lat_db_hash (rt_port_info_t *pi, rt_ipv4_addr_t ipaddr)
 
 void rt_lat_init (void)
 {
+    rt_lat_table = (rt_lat_t *) rt_numa_table_alloc("Local address table",
+        RT_LAR_TABLE_SIZE * sizeof(rt_lat_t));
     int idx;
     for (idx = 0 ; idx < RT_LAR_TABLE_SIZE ; idx++)
     {
@@ -584,8 +1589,7 @@ rt_lat_t *rt_lat_add (rt_port_info_t *pi, rt_ipv4_addr_t ipaddr,
         np = hd;
     } else {
         /* Allocate new entry */
-        np = (rt_lat_t *) malloc(sizeof(rt_lat_t));
-        assert(np != NULL);
+        np = (rt_lat_t *) rt_numa_entry_alloc(sizeof(rt_lat_t));
     }
     /* Populate Entry */
     np->pi = pi;
@@ -4,11 +4,18 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include <rte_atomic.h>
+#include <rte_spinlock.h>
+#include <rte_memory.h>
+#include <rte_hash_crc.h>
+#include <rte_prefetch.h>
+#include <rte_vect.h>
+
 #include "stats.h"
 #include "defines.h"
 #include "port.h"
 #include "pktutils.h"
-#include "port.h"
+#include "rcu.h"
 
 /**********************************************************************/
 /* Forwarding Flags */
@@ -16,6 +23,8 @@
 #define RT_FWD_F_DISCARD        (1 << 0)
 #define RT_FWD_F_RANDDISC       (1 << 1)
 #define RT_FWD_F_LOCAL          (1 << 2)
+/* DT entry only: next hop changed or expired, take the slow path */
+#define RT_FWD_F_INVALID        (1 << 3)
 
 #define RT_FWD_F_MASK           (0xff)
 
@@ -27,22 +36,91 @@ typedef struct __attribute__ ((__packed__)) {
     rt_eth_addr_t hwaddr; /* Local MAC address */
 } rt_dt_key_t;
 
-typedef struct rt_dt_route_s {
-    struct rt_dt_route_s *prev, *next;
-    rt_dt_key_t key;
+/*
+ * Forwarding information of a Direct-Table entry. Once published it
+ * is never modified; updates publish a new copy by pointer swap and
+ * the old copy is released through QSBR (see rcu.h).
+ */
+typedef struct {
     rt_port_info_t *pi;
     rt_port_index_t port;
     uint8_t flags;
-    uint8_t used;
     struct {
         rt_eth_addr_t dst;
         rt_eth_addr_t src;
     } eth;
-    rt_cnt_idx_t cntidx;
+    rt_cnt_idx_t cntidx;    /* Counter of this DT entry (flow) */
+    rt_cnt_idx_t rtcntidx;  /* Counter of the LPM route */
+} rt_dt_fwd_t;
+
+/* Direct-Table route (entry of the compact result array) */
+typedef struct {
+    rt_dt_key_t key;
+    uint32_t used;      /* rt_dt_clock at the last hit (for eviction) */
+    rt_dt_fwd_t *fwd;
 } rt_dt_route_t;
 
+/*
+ * Direct-Table bucket: exactly one cache line holding the 16-bit
+ * signatures of up to eight keys and their result array indices.
+ */
+#define RT_DT_BUCKET_ENTRIES    8
+
+typedef struct {
+    uint16_t sig[RT_DT_BUCKET_ENTRIES];
+    uint32_t idx[RT_DT_BUCKET_ENTRIES];
+} __rte_cache_aligned rt_dt_bucket_t;
+
+/* Signature values 0 and 1 are reserved */
+#define RT_DT_SIG_EMPTY         0
+#define RT_DT_SIG_BUSY          1
+#define RT_DT_SIG_MIN           2
+
+/*
+ * Dependencies of a DT entry (side array, same index as the result
+ * array). Each entry is linked into the lists of the LPM route and the
+ * AR entry it was built from, so that a change of either invalidates
+ * exactly the affected entries.
+ */
+#define RT_DT_IDX_NONE          UINT32_MAX
+
+typedef struct {
+    struct rt_lpm_s *rt;
+    struct rt_ipv4_ar_s *ar;
+    uint32_t rt_prev, rt_next;
+    uint32_t ar_prev, ar_next;
+} rt_dt_dep_t;
+
+typedef struct {
+    rt_dt_bucket_t *buckets;
+    rt_dt_route_t *routes;
+    rt_dt_dep_t *deps;
+    uint32_t bucket_mask;
+    uint32_t route_count;   /* Size of result array */
+    uint32_t route_next;    /* Next never used result index */
+    uint32_t route_used;    /* Published entries */
+    /* Released result indices */
+    rte_spinlock_t free_lock;
+    uint32_t *free_idx;
+    uint32_t free_cnt;
+    /* Eviction (rt_dt_sweep) */
+    uint32_t budget;        /* Entries kept before evicting */
+    uint32_t hand;          /* CLOCK hand (bucket index) */
+    /* Counters */
+    uint64_t inserts;
+    uint64_t insert_fail;   /* Both candidate buckets were full */
+    uint64_t evict_idle;
+    uint64_t evict_budget;
+} rt_dt_table_t;
+
+/* Coarse clock (seconds) advanced by the housekeeping thread */
+extern volatile uint32_t rt_dt_clock;
+
+/* CLOCK sweep: buckets visited per housekeeping tick */
+#define RT_DT_SWEEP_BUCKETS     512
+
 /**********************************************************************/
-/* Linear List of Route Data Entries */
+/* Route Data Entries (linear list + per-domain DIR-24-8 index) */
 
 typedef struct rt_lpm_s {
     struct rt_lpm_s *prev, *next;
@@ -60,12 +138,21 @@ typedef struct rt_lpm_s {
     };
     rt_rd_t nh_rdidx;
     rt_cnt_idx_t cntidx;
+    uint32_t lpmidx; /* Index in the DIR-24-8 result table */
+    /* Dependent DT entries (see rt_dt_dep_t) */
+    uint32_t dt_head;
+    uint32_t dt_gen;
 } rt_lpm_t;
 
 #define RT_LPM_F_HAS_NEXTHOP    (1 <<  8)
 #define RT_LPM_F_HAS_PORTINFO   (1 <<  9)
 #define RT_LPM_F_SUBNET         (1 << 10)
 
+/* Maximum number of routes (over all routing domains) */
+#define RT_LPM_MAX_ROUTES       (1 << 21)
+/* Number of 256-entry second-level groups per routing domain */
+#define RT_LPM_TBL8_GROUPS      (1 << 16)
+
 /**********************************************************************/
 /* Address Resolution Table */
 
@@ -77,13 +164,41 @@ typedef struct rt_ipv4_ar_s {
     /* Result */
     uint32_t flags;
     rt_eth_addr_t hwaddr; /* Remote MAC address */
-    rt_pkt_t pkt;
+    /* Packets waiting for resolution (circular, g.ar_queue_depth) */
+    rte_spinlock_t pend_lock;
+    rt_pkt_t *pend;
+    uint16_t pend_head;
+    uint16_t pend_cnt;
+    uint64_t pend_since;    /* TSC of the oldest queued packet */
+    uint64_t pend_drop; /* Dropped because the queue was full */
+    /* Aging (see rt_arp_timer_expire) */
+    uint64_t confirmed;     /* TSC of the last learned reply */
+    uint8_t probes;         /* Refresh requests since 'confirmed' */
+    uint64_t requested;     /* TSC of the last request sent */
+    rt_eth_addr_t prev_hwaddr; /* Replaced MAC (RT_AR_F_HW_CHANGED) */
+    /* Timer wheel linkage */
+    struct rt_ipv4_ar_s *tw_prev, *tw_next;
+    uint64_t tw_expire;     /* Tick; 0 when not scheduled */
+    /* Dependent DT entries (see rt_dt_dep_t) */
+    uint32_t dt_head;
+    uint32_t dt_gen;
 } rt_ipv4_ar_t;
 
 #define RT_IPV4_AR_TABLE_SIZE 8192
 
 #define RT_AR_F_HAS_HWADDR      (1 << 0)
-#define RT_AR_F_HAS_PKT         (1 << 1)
+#define RT_AR_F_STATIC          (1 << 1)
+#define RT_AR_F_STALE           (1 << 2)
+#define RT_AR_F_HW_CHANGED      (1 << 3)
+
+/* Timer wheel: 100ms ticks, 256 slots (entries may wrap around) */
+#define RT_AR_TW_TICK_MS        100
+#define RT_AR_TW_SLOTS          256
+/* Requests: one per second per entry, timer probes at most 32 per tick */
+#define RT_AR_PROBE_TICKS       10
+#define RT_AR_PROBES_PER_TICK   32
+/* Queued packets are discarded if unresolved after 3 seconds */
+#define RT_AR_PEND_TIMEOUT_TICKS 30
 
 /**********************************************************************/
 /* Local Address Resolution database */
@@ -104,57 +219,179 @@ typedef struct rt_lat_s {
 
 /**********************************************************************/
 
-#define RT_DT_SIZE 65536
-extern rt_dt_route_t rt_dt_table[RT_DT_SIZE];
+extern rt_dt_table_t rt_dt_table;
 
+/* CRC32-C over the full key (uses SSE4.2 when available) */
 static inline uint32_t
 rt_dt_hash (const rt_dt_key_t *key)
 {
-    uint16_t idx = key->prtidx 
-        + ((const uint16_t *) key)[0]
-        + ((const uint16_t *) key)[1]
-        + ((const uint16_t *) key)[5];
+    uint64_t w0;
+    uint32_t w1;
+    memcpy(&w0, key, sizeof(w0));
+    memcpy(&w1, &((const uint8_t *) key)[8], sizeof(w1));
+    return rte_hash_crc_4byte(w1, rte_hash_crc_8byte(w0, 0xffffffff));
+}
+
+static inline uint16_t
+rt_dt_sig (uint32_t hash)
+{
+    uint16_t sig = hash >> 16;
+    return (sig < RT_DT_SIG_MIN) ? sig + RT_DT_SIG_MIN : sig;
+}
+
+/*
+ * Each key has two candidate buckets. The alternate bucket can be
+ * derived from either one and the signature alone.
+ */
+static inline uint32_t
+rt_dt_bucket_prim (uint32_t hash)
+{
+    return hash & rt_dt_table.bucket_mask;
+}
+
+static inline uint32_t
+rt_dt_bucket_alt (uint32_t bidx, uint16_t sig)
+{
+    return (bidx ^ (sig * 0x5bd1e995U)) & rt_dt_table.bucket_mask;
+}
+
+/* Returns zero if the keys are equal (like memcmp) */
+static inline int
+rt_dt_key_compare (const rt_dt_key_t *key1, const rt_dt_key_t *key2)
+{
+    uint64_t a0, b0;
+    uint32_t a1, b1;
+    memcpy(&a0, key1, sizeof(a0));
+    memcpy(&b0, key2, sizeof(b0));
+    memcpy(&a1, &((const uint8_t *) key1)[8], sizeof(a1));
+    memcpy(&b1, &((const uint8_t *) key2)[8], sizeof(b1));
+    return ((a0 ^ b0) | (a1 ^ b1)) != 0;
+}
 
-    return (uint32_t) idx;
+static inline rt_dt_route_t *
+rt_dt_bucket_find (const rt_dt_bucket_t *bp, uint16_t sig,
+    const rt_dt_key_t *key)
+{
+#ifdef RTE_ARCH_X86
+    /* Compare all eight signatures at once */
+    __m128i sigs = _mm_load_si128((const __m128i *) bp->sig);
+    uint32_t mask = _mm_movemask_epi8(
+        _mm_cmpeq_epi16(sigs, _mm_set1_epi16(sig)));
+    rte_smp_rmb();
+    while (mask != 0) {
+        int i = __builtin_ctz(mask) >> 1;
+        mask &= ~(3U << (2 * i));
+        rt_dt_route_t *rp = &rt_dt_table.routes[bp->idx[i]];
+        if (likely(rt_dt_key_compare(key, &rp->key) == 0))
+            return rp;
+    }
+#else
+    int i;
+    for (i = 0 ; i < RT_DT_BUCKET_ENTRIES ; i++) {
+        if (rt_rcu_dereference(bp->sig[i]) == sig) {
+            rt_dt_route_t *rp = &rt_dt_table.routes[bp->idx[i]];
+            if (likely(rt_dt_key_compare(key, &rp->key) == 0))
+                return rp;
+        }
+    }
+#endif
+    return NULL;
 }
 
-#define rt_dt_key_compare(key1,key2) \
-    (memcmp((key1), (key2), sizeof(rt_dt_key_t)))
+static inline rt_dt_route_t *
+rt_dt_route_find_hash (const rt_dt_key_t *key, uint32_t hash)
+{
+    uint16_t sig = rt_dt_sig(hash);
+    uint32_t bidx = rt_dt_bucket_prim(hash);
+    rt_dt_route_t *rp;
+
+    rp = rt_dt_bucket_find(&rt_dt_table.buckets[bidx], sig, key);
+    if (likely(rp != NULL))
+        return rp;
+    bidx = rt_dt_bucket_alt(bidx, sig);
+    return rt_dt_bucket_find(&rt_dt_table.buckets[bidx], sig, key);
+}
 
 static inline rt_dt_route_t *
+rt_dt_route_find (const rt_dt_key_t *key)
+{
+    return rt_dt_route_find_hash(key, rt_dt_hash(key));
+}
+
+/*
+ * Prefetch helpers for the burst pipeline: first the primary bucket,
+ * then (once the bucket is cached) the result entries whose
+ * signature matches.
+ */
+static inline void
+rt_dt_prefetch_bucket (uint32_t hash)
+{
+    rte_prefetch0(&rt_dt_table.buckets[rt_dt_bucket_prim(hash)]);
+}
+
+static inline void
+rt_dt_prefetch_routes (uint32_t hash)
+{
+    const rt_dt_bucket_t *bp = &rt_dt_table.buckets[rt_dt_bucket_prim(hash)];
+    uint16_t sig = rt_dt_sig(hash);
+    int i;
+    for (i = 0 ; i < RT_DT_BUCKET_ENTRIES ; i++) {
+        if (bp->sig[i] == sig)
+            rte_prefetch0(&rt_dt_table.routes[bp->idx[i]]);
+    }
+}
+
+/*
+ * Mark an entry as used. Written at most once per clock second, so
+ * entries shared by several lcores do not bounce between caches.
+ */
+static inline void
+rt_dt_touch (const rt_dt_route_t *rp)
+{
+    uint32_t now = rt_dt_clock;
+    if (unlikely(rp->used != now))
+        ((rt_dt_route_t *) rp)->used = now;
+}
+
+/*
+ * Lock-free lookup. The returned forwarding information stays valid
+ * until the calling lcore reports its next quiescent state.
+ */
+static inline const rt_dt_fwd_t *
 rt_dt_lookup (const rt_dt_key_t *key)
 {
-    uint32_t idx = rt_dt_hash(key);
-    rt_dt_route_t *hd = &rt_dt_table[idx];
-
-    if (likely(rt_dt_key_compare(key, &hd->key) == 0))
-        return hd;
-
-    rt_dt_route_t *sp = hd;
-    for (;;) {
-        if (rt_dt_key_compare(key, &sp->key) == 0)
-            return sp;
-        sp = sp->next;
-        if (likely(sp == hd))
-            break;
+    const rt_dt_route_t *rp = rt_dt_route_find(key);
+    if (likely(rp != NULL)) {
+        rt_dt_touch(rp);
+        return rt_rcu_dereference(rp->fwd);
     }
+    rt_lcore_stats_self()->dt_miss++;
     return NULL;
 }
 
 rt_dt_route_t *
-    rt_dt_find_or_create (const rt_dt_key_t *key, const rt_dt_route_t *tp);
+    rt_dt_find_or_create (const rt_dt_key_t *key, const rt_dt_fwd_t *fwd);
 void rt_dt_set_fwd_info (rt_dt_route_t *dt, rt_lpm_t *rt, rt_ipv4_ar_t *ar,
     uint8_t flags);
-rt_dt_route_t *rt_dt_create (const rt_dt_route_t *drp);
+rt_dt_route_t *rt_dt_create (const rt_dt_key_t *key, const rt_dt_fwd_t *fwd);
 rt_dt_route_t *rt_dt_create_exception (rt_port_info_t *pi,
     rt_ipv4_addr_t ipaddr, uint8_t flags);
-void rt_dt_init (void);
+void rt_dt_init (uint32_t size, uint32_t budget);
+void rt_dt_sweep (void);
+void rt_dt_print_stats (FILE *fd);
 int rt_dt_sprintf (char *str, const rt_dt_route_t *dt);
 void rt_dt_dump (FILE *fd);
+void rt_dt_depend (rt_dt_route_t *dt, rt_lpm_t *rt, uint32_t rt_gen,
+    rt_ipv4_ar_t *ar, uint32_t ar_gen);
+int rt_dt_invalidate_route (rt_lpm_t *rt, const rt_ipv4_prefix_t *within);
+int rt_dt_invalidate_ar (rt_ipv4_ar_t *ar);
+void rt_dt_histogram (FILE *fd);
 
 /**********************************************************************/
 
 rt_lpm_t *rt_lpm_lookup (rt_rd_t rdidx, rt_ipv4_addr_t addr);
+void rt_lpm_lookup_bulk (rt_rd_t rdidx, const rt_ipv4_addr_t *addrs,
+    rt_lpm_t **rts, int count);
 rt_lpm_t *rt_lpm_lookup_subnet (rt_rd_t rdidx, rt_ipv4_addr_t addr);
 rt_lpm_t *rt_lpm_find_or_create (rt_rd_t rdidx,
     rt_ipv4_prefix_t prefix, rt_port_info_t *pi);
@@ -194,10 +431,12 @@ void rt_ar_table_init (void);
 rt_ipv4_ar_t *
 rt_ipv4_ar_lookup (rt_port_info_t *pi, rt_ipv4_addr_t ipaddr);
 rt_ipv4_ar_t *rt_ipv4_ar_find_or_create (rt_port_info_t *pi, rt_ipv4_addr_t ipaddr);
-int rt_ipv4_ar_get_pkt (rt_pkt_t *pkt, rt_ipv4_ar_t *ar);
+int rt_ipv4_ar_get_pkts (rt_ipv4_ar_t *ar, rt_pkt_t *pkts, int count);
 int rt_ipv4_ar_set_pkt (rt_pkt_t pkt, rt_ipv4_ar_t *ar);
+int rt_ipv4_ar_request_due (rt_ipv4_ar_t *ar, uint64_t now);
 rt_ipv4_ar_t *rt_ipv4_ar_learn (rt_port_info_t *pi, rt_ipv4_addr_t ipaddr,
     rt_eth_addr_t hwaddr);
+void rt_ipv4_ar_timer_run (void);
 
 /**********************************************************************/
 